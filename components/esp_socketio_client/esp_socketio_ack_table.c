@@ -0,0 +1,287 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <limits.h>
+#include "esp_socketio_ack_table.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_socketio_internal.h"
+
+static const char *TAG = "socketio_ack_table";
+
+#define SOCKETIO_ACK_WHEEL_SIZE     (64)
+#define SOCKETIO_ACK_NONE           (-1)
+
+typedef enum {
+    ACK_SLOT_FREE = 0,
+    ACK_SLOT_PENDING,
+    ACK_SLOT_EXPIRING,                              // Timed out, callback being called outside of the lock
+} esp_socketio_ack_slot_state_t;
+
+typedef struct {
+    esp_socketio_ack_slot_state_t   state;
+    int                             id;
+    esp_socketio_ack_cb_t           cb;
+    void                            *arg;
+    uint32_t                        expire_tick;
+    bool                            timed;          // Linked in the wheel
+    int                             prev;           // Neighbours in the wheel bucket, or in the expired list
+    int                             next;
+} esp_socketio_ack_slot_t;
+
+struct esp_socketio_ack_table {
+    esp_socketio_client_handle_t    client;
+    esp_socketio_ack_slot_t         *slots;         // Indexed by id & (size - 1)
+    size_t                          size;
+    int                             wheel[SOCKETIO_ACK_WHEEL_SIZE];    // Head slot of each bucket
+    uint32_t                        tick;
+    uint32_t                        tick_ms;
+    size_t                          timed_num;      // Pending acks with a timeout
+    bool                            timer_running;
+    bool                            stopped;
+    int                             next_id;
+    SemaphoreHandle_t               lock;
+    esp_timer_handle_t              timer;
+};
+
+static void wheel_link(esp_socketio_ack_table_handle_t ack_table, int index);
+static void wheel_unlink(esp_socketio_ack_table_handle_t ack_table, int index);
+static void ack_timer_callback(void *arg);
+
+esp_socketio_ack_table_handle_t esp_socketio_ack_table_create(esp_socketio_client_handle_t client, size_t size, uint32_t tick_ms)
+{
+    esp_socketio_ack_table_handle_t ack_table = calloc(1, sizeof(struct esp_socketio_ack_table));
+    ESP_SOCKETIO_MEM_CHECK(TAG, ack_table, return NULL);
+
+    ack_table->size = 1;
+    while (ack_table->size < size) {
+        ack_table->size <<= 1;
+    }
+    ack_table->slots = calloc(ack_table->size, sizeof(esp_socketio_ack_slot_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, ack_table->slots, goto error);
+    for (int i = 0; i < SOCKETIO_ACK_WHEEL_SIZE; i++) {
+        ack_table->wheel[i] = SOCKETIO_ACK_NONE;
+    }
+    ack_table->client = client;
+    ack_table->tick_ms = (tick_ms > 0) ? tick_ms : 1;
+
+    ack_table->lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, ack_table->lock, goto error);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = &ack_timer_callback,
+        .arg = (void *)ack_table,
+        .name = "sio_ack"
+    };
+    if (esp_timer_create(&timer_args, &ack_table->timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Error creating ack timer");
+        goto error;
+    }
+    return ack_table;
+
+error:
+    esp_socketio_ack_table_destroy(ack_table);
+    return NULL;
+}
+
+esp_err_t esp_socketio_ack_table_add(esp_socketio_ack_table_handle_t ack_table, uint32_t timeout_ms,
+                                     esp_socketio_ack_cb_t cb, void *arg, int *id_ptr)
+{
+    if (ack_table == NULL || cb == NULL || id_ptr == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(ack_table->lock, portMAX_DELAY);
+    // Ids are handed out in sequence; an id whose slot is still taken by an older ack is skipped
+    int index = SOCKETIO_ACK_NONE;
+    int first_id = ack_table->next_id;
+    for (size_t tries = 0; tries < ack_table->size; tries++) {
+        int id = ack_table->next_id;
+        ack_table->next_id = (id == INT_MAX) ? 0 : id + 1;
+        if (ack_table->slots[id & (ack_table->size - 1)].state == ACK_SLOT_FREE) {
+            index = id & (ack_table->size - 1);
+            ack_table->slots[index].id = id;
+            break;
+        }
+    }
+    if (index == SOCKETIO_ACK_NONE) {
+        ack_table->next_id = first_id;
+        xSemaphoreGive(ack_table->lock);
+        ESP_LOGE(TAG, "Too many pending acks (%d)", (int)ack_table->size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_socketio_ack_slot_t *slot = &ack_table->slots[index];
+    slot->state = ACK_SLOT_PENDING;
+    slot->cb = cb;
+    slot->arg = arg;
+    if (timeout_ms > 0) {
+        slot->expire_tick = ack_table->tick + (timeout_ms + ack_table->tick_ms - 1) / ack_table->tick_ms;
+        wheel_link(ack_table, index);
+        if (!ack_table->timer_running && !ack_table->stopped) {
+            ack_table->timer_running = (esp_timer_start_periodic(ack_table->timer, ack_table->tick_ms * 1000ULL) == ESP_OK);
+        }
+    }
+    *id_ptr = slot->id;
+    xSemaphoreGive(ack_table->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_socketio_ack_table_cancel(esp_socketio_ack_table_handle_t ack_table, int id)
+{
+    if (ack_table == NULL || id < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(ack_table->lock, portMAX_DELAY);
+    int index = id & (ack_table->size - 1);
+    esp_socketio_ack_slot_t *slot = &ack_table->slots[index];
+    if (slot->state == ACK_SLOT_PENDING && slot->id == id) {
+        wheel_unlink(ack_table, index);
+        slot->state = ACK_SLOT_FREE;
+        ret = ESP_OK;
+    }
+    xSemaphoreGive(ack_table->lock);
+    return ret;
+}
+
+bool esp_socketio_ack_table_complete(esp_socketio_ack_table_handle_t ack_table, esp_socketio_packet_handle_t packet)
+{
+    int id = esp_socketio_packet_get_event_id(packet);
+    if (ack_table == NULL || id < 0) {
+        return false;
+    }
+
+    esp_socketio_ack_cb_t cb = NULL;
+    void *arg = NULL;
+    xSemaphoreTake(ack_table->lock, portMAX_DELAY);
+    int index = id & (ack_table->size - 1);
+    esp_socketio_ack_slot_t *slot = &ack_table->slots[index];
+    if (slot->state == ACK_SLOT_PENDING && slot->id == id) {
+        wheel_unlink(ack_table, index);
+        slot->state = ACK_SLOT_FREE;
+        cb = slot->cb;
+        arg = slot->arg;
+    }
+    xSemaphoreGive(ack_table->lock);
+
+    if (cb == NULL) {
+        return false;
+    }
+    cb(ack_table->client, packet, arg);
+    return true;
+}
+
+void esp_socketio_ack_table_stop(esp_socketio_ack_table_handle_t ack_table)
+{
+    if (ack_table == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(ack_table->lock, portMAX_DELAY);
+    ack_table->stopped = true;
+    if (ack_table->timer_running) {
+        esp_timer_stop(ack_table->timer);
+        ack_table->timer_running = false;
+    }
+    xSemaphoreGive(ack_table->lock);
+}
+
+void esp_socketio_ack_table_destroy(esp_socketio_ack_table_handle_t ack_table)
+{
+    if (ack_table == NULL) {
+        return;
+    }
+
+    if (ack_table->timer) {
+        esp_timer_stop(ack_table->timer);
+        esp_timer_delete(ack_table->timer);
+    }
+    if (ack_table->lock) {
+        vSemaphoreDelete(ack_table->lock);
+    }
+    free(ack_table->slots);
+    free(ack_table);
+}
+
+void wheel_link(esp_socketio_ack_table_handle_t ack_table, int index)
+{
+    esp_socketio_ack_slot_t *slot = &ack_table->slots[index];
+    int *head = &ack_table->wheel[slot->expire_tick % SOCKETIO_ACK_WHEEL_SIZE];
+    slot->prev = SOCKETIO_ACK_NONE;
+    slot->next = *head;
+    if (*head != SOCKETIO_ACK_NONE) {
+        ack_table->slots[*head].prev = index;
+    }
+    *head = index;
+    slot->timed = true;
+    ack_table->timed_num++;
+}
+
+void wheel_unlink(esp_socketio_ack_table_handle_t ack_table, int index)
+{
+    esp_socketio_ack_slot_t *slot = &ack_table->slots[index];
+    if (!slot->timed) {
+        return;
+    }
+
+    if (slot->prev != SOCKETIO_ACK_NONE) {
+        ack_table->slots[slot->prev].next = slot->next;
+    } else {
+        ack_table->wheel[slot->expire_tick % SOCKETIO_ACK_WHEEL_SIZE] = slot->next;
+    }
+    if (slot->next != SOCKETIO_ACK_NONE) {
+        ack_table->slots[slot->next].prev = slot->prev;
+    }
+    slot->timed = false;
+    ack_table->timed_num--;
+}
+
+void ack_timer_callback(void *arg)
+{
+    esp_socketio_ack_table_handle_t ack_table = (esp_socketio_ack_table_handle_t)arg;
+
+    // Move the acks due in this tick to a local list; entries of later rounds stay in the bucket
+    int expired = SOCKETIO_ACK_NONE;
+    xSemaphoreTake(ack_table->lock, portMAX_DELAY);
+    ack_table->tick++;
+    int index = ack_table->wheel[ack_table->tick % SOCKETIO_ACK_WHEEL_SIZE];
+    while (index != SOCKETIO_ACK_NONE) {
+        esp_socketio_ack_slot_t *slot = &ack_table->slots[index];
+        int next = slot->next;
+        if ((int32_t)(ack_table->tick - slot->expire_tick) >= 0) {
+            wheel_unlink(ack_table, index);
+            slot->state = ACK_SLOT_EXPIRING;
+            slot->next = expired;
+            expired = index;
+        }
+        index = next;
+    }
+    if (ack_table->timed_num == 0) {
+        esp_timer_stop(ack_table->timer);
+        ack_table->timer_running = false;
+    }
+    xSemaphoreGive(ack_table->lock);
+
+    // Expiring slots are not reused until their callback has returned
+    for (index = expired; index != SOCKETIO_ACK_NONE; index = ack_table->slots[index].next) {
+        ESP_LOGD(TAG, "Ack %d timed out", ack_table->slots[index].id);
+        ack_table->slots[index].cb(ack_table->client, NULL, ack_table->slots[index].arg);
+    }
+
+    xSemaphoreTake(ack_table->lock, portMAX_DELAY);
+    while (expired != SOCKETIO_ACK_NONE) {
+        esp_socketio_ack_slot_t *slot = &ack_table->slots[expired];
+        expired = slot->next;
+        slot->state = ACK_SLOT_FREE;
+        slot->next = SOCKETIO_ACK_NONE;
+    }
+    xSemaphoreGive(ack_table->lock);
+}
@@ -5,6 +5,8 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
+#include <stdarg.h>
 
 #include "esp_socketio_client.h"
 #include "esp_transport.h"
@@ -20,14 +22,43 @@
 #include "esp_timer.h"
 #include "esp_tls_crypto.h"
 #include "esp_system.h"
+#include "esp_random.h"
 #include <errno.h>
 #include <arpa/inet.h>
 #include "esp_socketio_ns_list.h"
 #include "esp_socketio_internal.h"
+#include "esp_socketio_ack_table.h"
+#include "esp_socketio_offline_buffer.h"
+#include "esp_socketio_outbox.h"
+#include "esp_socketio_ring.h"
+#include "esp_socketio_packet_pool.h"
+#include "esp_socketio_json_arena.h"
 
 static const char *TAG = "socketio_client";
 
 #define SOCKETIO_EVENT_QUEUE_SIZE       (1)
+#define SOCKETIO_CONNECT_BUFFER_SIZE    (128)
+#define SOCKETIO_EVENT_TABLE_MIN_SIZE   (8)
+#define SOCKETIO_CONTROL_QUEUE_SIZE     (8)     // Initial size of the control lane, doubled when full
+#define SOCKETIO_CONTROL_INLINE_SIZE    (8)
+#define SOCKETIO_RECOVERY_ID_MAX_LEN    (40)
+#define SOCKETIO_CHUNK_EVENT            "sio-chunk"
+// Socket.IO header and arguments of a chunk, apart from the namespace
+#define SOCKETIO_CHUNK_TEXT_SIZE        (128)
+
+#define TX_READY_BIT                    (1 << 0)
+#define TX_STOP_BIT                     (1 << 1)
+#define TX_STOPPED_BIT                  (1 << 2)
+#define TX_CONTROL_SENT_BIT             (1 << 3)
+#define TX_OFFLINE_BIT                  (1 << 4)
+#define TX_DIRECT_IDLE_BIT              (1 << 5)
+
+#define DISPATCH_READY_BIT              (1 << 0)
+#define DISPATCH_SPACE_BIT              (1 << 1)
+#define DISPATCH_STOP_BIT               (1 << 2)
+#define DISPATCH_STOPPED_BIT            (1 << 3)
+#define DISPATCH_PING_TIMEOUT_BIT       (1 << 4)
+#define DISPATCH_OFFLINE_BIT            (1 << 5)
 
 ESP_EVENT_DEFINE_BASE(SOCKETIO_EVENTS);
 
@@ -42,11 +73,62 @@ typedef enum {
     SOCKETIO_STATE_CLOSED,
 } socketio_client_state_t;
 
+// Handlers and sinks registered for one event name in one namespace
+typedef struct esp_sio_event_entry {
+    struct esp_sio_event_entry      *next;                  // Next entry in the same bucket
+    uint32_t                        hash;
+    esp_socketio_event_handler_t    handler;
+    void                            *handler_arg;
+    esp_socketio_binary_sink_cb_t   sink;
+    void                            *sink_arg;
+    uint32_t                        sink_id;                // Changed on every registration of the sink, 0 without sink
+    char                            nsp[ESP_SOCKETIO_NSP_MAX_LEN + 1];
+    char                            event_name[];
+} esp_sio_event_entry_t;
+
+// Namespace joined by the client, connected again on every OPEN
+typedef struct {
+    char                            nsp[ESP_SOCKETIO_NSP_MAX_LEN + 1];
+    char                            *frame;                 // CONNECT packet without recovery data, encoded when joined
+    size_t                          len;
+    cJSON                           *auth;                  // Copy of the CONNECT payload, completed with the recovery data
+    bool                            configured;             // Listed in esp_socketio_client_config_t
+    bool                            joined;                 // Not disconnected by the server
+    bool                            connecting;             // CONNECT sent on this connection, not answered yet
+    bool                            recovered;              // The server restored the previous session on the last CONNECT
+    char                            pid[SOCKETIO_RECOVERY_ID_MAX_LEN + 1];     // Private session id, empty without recovery
+    char                            offset[SOCKETIO_RECOVERY_ID_MAX_LEN + 1];  // Offset of the last event received
+} esp_sio_session_t;
+
+// Handler called inline by esp_sio_client_dispatch_event with direct_dispatch
+typedef struct {
+    esp_event_handler_t             handler;
+    void                            *arg;
+} esp_sio_direct_handler_t;
+
+// Event handed to the dispatch task, with the received packet it now owns, NULL if none
+typedef struct {
+    int32_t                         event;
+    esp_socketio_packet_handle_t    packet;
+} esp_sio_dispatch_item_t;
+
+// Control frame (PONG, CONNECT, CLOSE) waiting in the control lane of the TX task
+typedef struct {
+    char                            *data;                  // Heap copy, NULL if the frame fits inline
+    char                            inline_data[SOCKETIO_CONTROL_INLINE_SIZE];
+    size_t                          len;
+    int64_t                         ping_time;              // Reception time of the PING answered by a PONG, 0 otherwise
+} esp_sio_control_frame_t;
+
 struct esp_socketio_client {
     esp_websocket_client_handle_t   ws_client;
-    esp_event_loop_handle_t         event_handle;
+    esp_event_loop_handle_t         event_handle;           // NULL with direct_dispatch
+    bool                            direct_dispatch;
+    esp_sio_direct_handler_t        direct_handlers[SOCKETIO_EVENT_MAX + 1];   // Indexed by event id + 1, SOCKETIO_EVENT_ANY first
     esp_timer_handle_t              sio_ping_timer;
     esp_socketio_ns_list_handle_t   ns_list;
+    esp_socketio_ack_table_handle_t ack_table;
+    esp_socketio_packet_pool_handle_t packet_pool;          // Received packets and packets acquired for sending
     esp_socketio_packet_handle_t    rx_packet;
     esp_socketio_packet_handle_t    tx_packet;
     socketio_client_state_t         socketio_state;
@@ -54,161 +136,1720 @@ struct esp_socketio_client {
     int                             ping_interval;
     int                             ping_timeout;
     int                             max_payload;
+    char                            *rx_buffer;             // Reassembly buffer for messages split over several DATA events
+    size_t                          rx_buffer_size;
+    size_t                          rx_len;
+    size_t                          rx_max_message_size;
+    uint8_t                         rx_op_code;             // Op code of the message being reassembled, 0 if none
+    bool                            rx_discard;             // Drop the rest of an oversized message
+    esp_sio_event_entry_t           **event_table;          // Hash table of registered event names, chained
+    size_t                          event_table_size;       // Number of buckets, a power of 2
+    size_t                          event_num;
+    SemaphoreHandle_t               event_lock;             // The application registers events while they are dispatched
+    esp_socketio_binary_sink_cb_t   rx_sink;                // Sink receiving the attachments of the current binary event
+    void                            *rx_sink_arg;
+    uint32_t                        rx_sink_id;             // sink_id of its entry, to notice its removal
+    uint32_t                        next_sink_id;           // Protected by event_lock
+    int                             rx_sink_index;
+    size_t                          rx_sink_offset;
+    size_t                          rx_sink_total;
+    bool                            rx_sink_failed;
+    unsigned char                   *tx_chunk_buffer;       // Scratch buffer for attachments produced by a reader
+    esp_socketio_packet_handle_t    *tx_queue;              // Ring of packets waiting for the TX task, NULL to send on the caller's task
+    size_t                          tx_queue_size;
+    size_t                          tx_queue_head;
+    size_t                          tx_queue_len;
+    esp_socketio_packet_handle_t    *tx_free;               // Pool of empty packets that can be queued
+    size_t                          tx_free_num;
+    SemaphoreHandle_t               tx_lock;
+    EventGroupHandle_t              tx_status;
+    TaskHandle_t                    tx_task;
+    esp_sio_control_frame_t         *tx_control;            // Control lane, drained before the queued packets
+    size_t                          tx_control_size;
+    size_t                          tx_control_head;
+    size_t                          tx_control_len;
+    bool                            tx_busy;                // Without a TX queue, a packet with attachments is being sent
+    size_t                          tx_direct_num;          // Without a TX queue, control frames being sent right away
+    TaskHandle_t                    rx_task;                // Task of the WebSocket client, running websocket_event_handler
+    esp_socketio_heartbeat_stats_t  heartbeat;
+    esp_sio_session_t               **sessions;             // Namespaces connected on OPEN, configured ones first
+    size_t                          session_num;
+    size_t                          configured_num;
+    SemaphoreHandle_t               session_lock;           // Sessions are added by the application while the receiving task reads them
+    bool                            configured_ready;       // SOCKETIO_EVENT_NS_READY posted for the current session
+    int                             reconnect_base_ms;
+    int                             reconnect_max_ms;
+    uint32_t                        reconnect_attempt;      // Disconnections since the last OPEN
+    esp_socketio_offline_buffer_handle_t offline;           // Packets emitted while disconnected, NULL if disabled
+    esp_socketio_outbox_handle_t    outbox;                 // Persistent journal used instead of `offline`, NULL if disabled
+    bool                            chunked_transfer;
+    uint32_t                        chunk_id;               // Id of the next chunked transfer
+    esp_socketio_ring_handle_t      dispatch_ring;          // Events posted by the receiving task to the dispatch task
+    esp_socketio_ring_handle_t      dispatch_free;          // Pool of empty packets given back by the dispatch task
+    EventGroupHandle_t              dispatch_status;        // Created for every client, it also carries work of the esp_timer task
+    TaskHandle_t                    dispatch_task;          // NULL to run the handlers on the receiving task
 };
 
-static esp_err_t esp_sio_client_dispatch_event(esp_socketio_client_handle_t client,
-        esp_socketio_event_id_t event,
-        const void *data,
-        int data_len)
+static esp_err_t esp_sio_client_dispatch_event(esp_socketio_client_handle_t client,
+        esp_socketio_event_id_t event,
+        const void *data,
+        int data_len)
+{
+    esp_err_t err;
+
+    if (client->direct_dispatch) {
+        // Same handler arguments as through the event loop, without copying the data and going through its queue.
+        // Copied under the lock and called outside it, so a handler can register events.
+        xSemaphoreTake(client->event_lock, portMAX_DELAY);
+        esp_sio_direct_handler_t handler = client->direct_handlers[event + 1];
+        esp_sio_direct_handler_t any = client->direct_handlers[SOCKETIO_EVENT_ANY + 1];
+        xSemaphoreGive(client->event_lock);
+        if (handler.handler != NULL) {
+            handler.handler(handler.arg, SOCKETIO_EVENTS, event, (void *)data);
+        }
+        if (any.handler != NULL) {
+            any.handler(any.arg, SOCKETIO_EVENTS, event, (void *)data);
+        }
+        return ESP_OK;
+    }
+
+    if ((err = esp_event_post_to(client->event_handle,
+                                 SOCKETIO_EVENTS, event,
+                                 data,
+                                 sizeof(esp_socketio_event_data_t),
+                                 portMAX_DELAY)) != ESP_OK) {
+        return err;
+    }
+    return esp_event_loop_run(client->event_handle, 0);
+}
+
+// Only called by the receiving task, the single producer of the dispatch ring. With `take_packet`,
+// rx_packet is handed to the dispatch task and replaced by an empty packet of the pool
+static void esp_sio_client_dispatch_post(esp_socketio_client_handle_t client, int32_t event, bool take_packet)
+{
+    esp_sio_dispatch_item_t item = { .event = event, .packet = NULL };
+    if (take_packet) {
+        esp_socketio_packet_handle_t spare;
+        while (!esp_socketio_ring_pop(client->dispatch_free, &spare)) {
+            // Every packet of the pool is waiting for its handlers: stop reading the socket until one is back
+            if (xEventGroupWaitBits(client->dispatch_status, DISPATCH_SPACE_BIT | DISPATCH_STOP_BIT,
+                                    pdFALSE, pdFALSE, portMAX_DELAY) & DISPATCH_STOP_BIT) {
+                return;
+            }
+            xEventGroupClearBits(client->dispatch_status, DISPATCH_SPACE_BIT);
+        }
+        item.packet = client->rx_packet;
+        client->rx_packet = spare;
+    }
+    while (!esp_socketio_ring_push(client->dispatch_ring, &item)) {
+        if (xEventGroupWaitBits(client->dispatch_status, DISPATCH_SPACE_BIT | DISPATCH_STOP_BIT,
+                                pdFALSE, pdFALSE, portMAX_DELAY) & DISPATCH_STOP_BIT) {
+            // The client is being destroyed, the event is dropped
+            esp_socketio_packet_release(item.packet);
+            return;
+        }
+        xEventGroupClearBits(client->dispatch_status, DISPATCH_SPACE_BIT);
+    }
+    xEventGroupSetBits(client->dispatch_status, DISPATCH_READY_BIT);
+}
+
+// Dispatch an event of the receiving task, through the dispatch task if there is one
+static void esp_sio_client_notify(esp_socketio_client_handle_t client, int32_t event, esp_socketio_event_data_t *socketio_event_data)
+{
+    if (client->dispatch_task != NULL) {
+        esp_sio_client_dispatch_post(client, event, socketio_event_data->socketio_packet == client->rx_packet);
+        return;
+    }
+    esp_sio_client_dispatch_event(client, event, socketio_event_data, sizeof(esp_socketio_event_data_t));
+}
+
+static esp_err_t esp_sio_client_encode_connect(const esp_socketio_packet_header_t *header, const cJSON *data,
+        char *buf, size_t buf_size, size_t *out_len)
+{
+    esp_err_t ret = esp_socketio_packet_encode_header(header, buf, buf_size, out_len);
+    if (ret != ESP_OK || data == NULL) {
+        return ret;
+    }
+
+    if (!cJSON_PrintPreallocated((cJSON *)data, buf + *out_len, buf_size - *out_len, false)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_len += strlen(buf + *out_len);
+    return ESP_OK;
+}
+
+// Encode a CONNECT packet into a heap buffer sized to fit
+static esp_err_t esp_sio_client_encode_connect_alloc(const char *nsp, const cJSON *data, char **frame_ptr, size_t *len_ptr)
+{
+    esp_socketio_packet_header_t header = {
+        .eio_type = EIO_PACKET_TYPE_MESSAGE,
+        .sio_type = SIO_PACKET_TYPE_CONNECT,
+        .nsp = nsp,
+        .nsp_len = strlen(nsp),
+        .event_id = -1,
+    };
+    size_t buffer_size = SOCKETIO_CONNECT_BUFFER_SIZE;
+    esp_err_t ret;
+    char *frame = NULL;
+    do {
+        free(frame);
+        frame = malloc(buffer_size);
+        ESP_SOCKETIO_MEM_CHECK(TAG, frame, return ESP_ERR_NO_MEM);
+        ret = esp_sio_client_encode_connect(&header, data, frame, buffer_size, len_ptr);
+        buffer_size *= 2;
+    } while (ret == ESP_ERR_INVALID_SIZE);
+
+    if (ret != ESP_OK) {
+        free(frame);
+        return ret;
+    }
+    *frame_ptr = frame;
+    return ESP_OK;
+}
+
+// Called with session_lock held. Sessions are never freed before the client, so the result stays valid after.
+static esp_sio_session_t *esp_sio_client_find_session(esp_socketio_client_handle_t client, const char *nsp)
+{
+    if (nsp == NULL || nsp[0] == '\0') {
+        nsp = "/";
+    }
+    for (size_t i = 0; i < client->session_num; i++) {
+        if (strcmp(client->sessions[i]->nsp, nsp) == 0) {
+            return client->sessions[i];
+        }
+    }
+    return NULL;
+}
+
+// Store the CONNECT packet of a namespace so that it is sent again after a reconnection
+static esp_err_t esp_sio_client_add_session(esp_socketio_client_handle_t client, const char *nsp, const cJSON *auth,
+        const char *frame, size_t len, bool configured)
+{
+    if (nsp == NULL || nsp[0] == '\0') {
+        nsp = "/";
+    }
+    if (strlen(nsp) > ESP_SOCKETIO_NSP_MAX_LEN) {
+        ESP_LOGE(TAG, "Namespace \"%s\" is too long.", nsp);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Copied before taking the lock, so that only the receiving task waits for the allocations
+    char *frame_copy = malloc(len);
+    ESP_SOCKETIO_MEM_CHECK(TAG, frame_copy, return ESP_ERR_NO_MEM);
+    memcpy(frame_copy, frame, len);
+    cJSON *auth_copy = NULL;
+    if (auth != NULL) {
+        auth_copy = cJSON_Duplicate(auth, true);
+        ESP_SOCKETIO_MEM_CHECK(TAG, auth_copy, {
+            free(frame_copy);
+            return ESP_ERR_NO_MEM;
+        });
+    }
+
+    xSemaphoreTake(client->session_lock, portMAX_DELAY);
+    esp_sio_session_t *session = esp_sio_client_find_session(client, nsp);
+    if (session == NULL) {
+        esp_sio_session_t **sessions = realloc(client->sessions, (client->session_num + 1) * sizeof(esp_sio_session_t *));
+        session = (sessions != NULL) ? calloc(1, sizeof(esp_sio_session_t)) : NULL;
+        if (sessions != NULL) {
+            client->sessions = sessions;
+        }
+        ESP_SOCKETIO_MEM_CHECK(TAG, session, {
+            xSemaphoreGive(client->session_lock);
+            free(frame_copy);
+            cJSON_Delete(auth_copy);
+            return ESP_ERR_NO_MEM;
+        });
+        strcpy(session->nsp, nsp);
+        client->sessions[client->session_num++] = session;
+    }
+
+    free(session->frame);
+    cJSON_Delete(session->auth);
+    session->frame = frame_copy;
+    session->len = len;
+    session->auth = auth_copy;
+    session->configured |= configured;
+    session->joined = true;
+    xSemaphoreGive(client->session_lock);
+    return ESP_OK;
+}
+
+static void esp_sio_client_set_connecting(esp_socketio_client_handle_t client, const char *nsp, bool connecting)
+{
+    xSemaphoreTake(client->session_lock, portMAX_DELAY);
+    esp_sio_session_t *session = esp_sio_client_find_session(client, nsp);
+    if (session != NULL) {
+        session->connecting = connecting;
+    }
+    xSemaphoreGive(client->session_lock);
+}
+
+static void esp_sio_client_free_sessions(esp_socketio_client_handle_t client)
+{
+    for (size_t i = 0; i < client->session_num; i++) {
+        free(client->sessions[i]->frame);
+        cJSON_Delete(client->sessions[i]->auth);
+        free(client->sessions[i]);
+    }
+    free(client->sessions);
+    if (client->session_lock) {
+        vSemaphoreDelete(client->session_lock);
+    }
+}
+
+static esp_err_t esp_sio_client_send_session_connect(esp_socketio_client_handle_t client, esp_sio_session_t *session)
+{
+    if (session->pid[0] == '\0' || (session->auth != NULL && !cJSON_IsObject(session->auth))) {
+        return (esp_websocket_client_send_text(client->ws_client, session->frame, session->len, portMAX_DELAY) < 0) ? ESP_FAIL : ESP_OK;
+    }
+
+    // Connection state recovery: the server replays what was sent after `offset` to the session `pid`
+    cJSON *auth = (session->auth != NULL) ? cJSON_Duplicate(session->auth, true) : cJSON_CreateObject();
+    ESP_SOCKETIO_MEM_CHECK(TAG, auth, return ESP_ERR_NO_MEM);
+    cJSON_AddStringToObject(auth, "pid", session->pid);
+    if (session->offset[0] != '\0') {
+        cJSON_AddStringToObject(auth, "offset", session->offset);
+    }
+    char *frame = NULL;
+    size_t len = 0;
+    esp_err_t ret = esp_sio_client_encode_connect_alloc(session->nsp, auth, &frame, &len);
+    cJSON_Delete(auth);
+    if (ret == ESP_OK && esp_websocket_client_send_text(client->ws_client, frame, len, portMAX_DELAY) < 0) {
+        ret = ESP_FAIL;
+    }
+    free(frame);
+    return ret;
+}
+
+static void esp_sio_client_connect_sessions(esp_socketio_client_handle_t client)
+{
+    client->configured_ready = false;
+    // Nothing else can be queued before a namespace is connected, so the frames go straight to the
+    // transport, bypassing the control lane, which is smaller than the namespace list may be.
+    // Namespaces disconnected by the server, configured ones included, are not joined again.
+    xSemaphoreTake(client->session_lock, portMAX_DELAY);
+    for (size_t i = 0; i < client->session_num; i++) {
+        esp_sio_session_t *session = client->sessions[i];
+        session->connecting = session->joined;
+        if (session->joined && esp_sio_client_send_session_connect(client, session) != ESP_OK) {
+            ESP_LOGE(TAG, "Send connect to \"%s\" failed.", session->nsp);
+            session->connecting = false;
+        }
+    }
+    xSemaphoreGive(client->session_lock);
+}
+
+static void esp_sio_client_check_configured(esp_socketio_client_handle_t client, esp_socketio_event_data_t *socketio_event_data)
+{
+    if (client->configured_num == 0 || client->configured_ready) {
+        return;
+    }
+    bool ready = true;
+    xSemaphoreTake(client->session_lock, portMAX_DELAY);
+    for (size_t i = 0; i < client->configured_num && ready; i++) {
+        ready = esp_socketio_ns_list_is_nsp_exist(client->ns_list, client->sessions[i]->nsp);
+    }
+    xSemaphoreGive(client->session_lock);
+    if (!ready) {
+        return;
+    }
+    client->configured_ready = true;
+    socketio_event_data->socketio_packet = NULL;
+    esp_sio_client_notify(client, SOCKETIO_EVENT_NS_READY, socketio_event_data);
+}
+
+static void esp_sio_client_session_connected(esp_socketio_client_handle_t client, const char *nsp, cJSON *json)
+{
+    // The recovery fields are only used by the receiving task
+    xSemaphoreTake(client->session_lock, portMAX_DELAY);
+    esp_sio_session_t *session = esp_sio_client_find_session(client, nsp);
+    if (session != NULL) {
+        session->connecting = false;
+    }
+    xSemaphoreGive(client->session_lock);
+    if (session == NULL) {
+        return;
+    }
+    esp_socketio_ns_list_set_data(client->ns_list, nsp, session);
+
+    cJSON *json_pid = cJSON_GetObjectItem(json, "pid");
+    if (!cJSON_IsString(json_pid) || json_pid->valuestring == NULL
+        || strlen(json_pid->valuestring) > SOCKETIO_RECOVERY_ID_MAX_LEN) {
+        // Recovery is not enabled on the server
+        session->pid[0] = '\0';
+        session->offset[0] = '\0';
+        session->recovered = false;
+        return;
+    }
+    session->recovered = (session->pid[0] != '\0' && strcmp(session->pid, json_pid->valuestring) == 0);
+    if (!session->recovered) {
+        strcpy(session->pid, json_pid->valuestring);
+        session->offset[0] = '\0';
+    }
+    ESP_LOGI(TAG, "Session of \"%s\" %s", session->nsp, session->recovered ? "recovered" : "started");
+}
+
+// With recovery enabled, the server appends the offset of each event as its last argument
+static void esp_sio_client_record_offset(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet)
+{
+    esp_sio_session_t *session = esp_socketio_ns_list_get_data(client->ns_list, esp_socketio_packet_get_nsp(packet));
+    if (session == NULL || session->pid[0] == '\0') {
+        return;
+    }
+    int count = esp_socketio_packet_get_arg_count(packet);
+    cJSON *offset = (count > 0) ? esp_socketio_packet_get_arg(packet, count - 1) : NULL;
+    if (cJSON_IsString(offset) && offset->valuestring != NULL && strlen(offset->valuestring) <= SOCKETIO_RECOVERY_ID_MAX_LEN) {
+        strcpy(session->offset, offset->valuestring);
+    }
+}
+
+static void esp_sio_client_schedule_reconnect(esp_socketio_client_handle_t client)
+{
+    // Full jitter over the upper half of an exponential backoff, so that clients dropped together
+    // by an outage do not reconnect together
+    uint32_t shift = (client->reconnect_attempt < 16) ? client->reconnect_attempt : 16;
+    uint64_t delay = (uint64_t)client->reconnect_base_ms << shift;
+    if (delay > (uint64_t)client->reconnect_max_ms) {
+        delay = client->reconnect_max_ms;
+    }
+    delay = delay / 2 + esp_random() % (delay / 2 + 1);
+    client->reconnect_attempt++;
+    ESP_LOGI(TAG, "Reconnecting in %d ms (attempt %" PRIu32 ")", (int)delay, client->reconnect_attempt);
+    esp_websocket_client_set_reconnect_timeout(client->ws_client, (int)delay);
+}
+
+static void esp_sio_client_record_heartbeat(esp_socketio_client_handle_t client, int64_t ping_time)
+{
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - ping_time);
+    client->heartbeat.last_latency_us = latency;
+    if (latency > client->heartbeat.max_latency_us) {
+        client->heartbeat.max_latency_us = latency;
+    }
+    client->heartbeat.total_latency_us += latency;
+    client->heartbeat.pong_count++;
+}
+
+static esp_err_t esp_sio_client_send_control_frame(esp_socketio_client_handle_t client, const char *data, size_t len,
+        int64_t ping_time, TickType_t timeout)
+{
+    if (esp_websocket_client_send_text(client->ws_client, data, len, timeout) < 0) {
+        return ESP_FAIL;
+    }
+    if (ping_time > 0) {
+        esp_sio_client_record_heartbeat(client, ping_time);
+    }
+    return ESP_OK;
+}
+
+// Called with tx_lock held. The lane grows rather than dropping frames or waiting for room: the receiving task
+// would block behind a sender waiting for the WebSocket client lock, which the receiving task holds.
+static esp_err_t esp_sio_client_grow_control(esp_socketio_client_handle_t client)
+{
+    size_t new_size = (client->tx_control_size == 0) ? SOCKETIO_CONTROL_QUEUE_SIZE : client->tx_control_size * 2;
+    esp_sio_control_frame_t *lane = malloc(new_size * sizeof(esp_sio_control_frame_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, lane, return ESP_ERR_NO_MEM);
+    for (size_t i = 0; i < client->tx_control_len; i++) {
+        lane[i] = client->tx_control[(client->tx_control_head + i) % client->tx_control_size];
+    }
+    free(client->tx_control);
+    client->tx_control = lane;
+    client->tx_control_size = new_size;
+    client->tx_control_head = 0;
+    return ESP_OK;
+}
+
+// With a TX queue the frame is put ahead of all queued packets. Without one it is sent right away, unless a packet
+// with attachments is being sent: it then waits in the control lane until the packet is complete.
+static esp_err_t esp_sio_client_send_control(esp_socketio_client_handle_t client, const char *data, size_t len, int64_t ping_time)
+{
+    if (client->tx_queue == NULL) {
+        xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+        bool busy = client->tx_busy;
+        if (!busy && client->tx_direct_num++ == 0) {
+            xEventGroupClearBits(client->tx_status, TX_DIRECT_IDLE_BIT);
+        }
+        xSemaphoreGive(client->tx_lock);
+        if (!busy) {
+            esp_err_t ret = esp_sio_client_send_control_frame(client, data, len, ping_time, portMAX_DELAY);
+            xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+            if (--client->tx_direct_num == 0) {
+                xEventGroupSetBits(client->tx_status, TX_DIRECT_IDLE_BIT);
+            }
+            xSemaphoreGive(client->tx_lock);
+            return ret;
+        }
+    }
+
+    esp_sio_control_frame_t frame = { .len = len, .ping_time = ping_time };
+    if (len > sizeof(frame.inline_data)) {
+        frame.data = malloc(len);
+        ESP_SOCKETIO_MEM_CHECK(TAG, frame.data, return ESP_ERR_NO_MEM);
+        memcpy(frame.data, data, len);
+    } else {
+        memcpy(frame.inline_data, data, len);
+    }
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    if (client->tx_control_len == client->tx_control_size) {
+        ret = esp_sio_client_grow_control(client);
+    }
+    if (ret == ESP_OK) {
+        client->tx_control[(client->tx_control_head + client->tx_control_len) % client->tx_control_size] = frame;
+        client->tx_control_len++;
+        // Cleared under the lock, so the lane can only be reported empty once this frame is sent
+        xEventGroupClearBits(client->tx_status, TX_CONTROL_SENT_BIT);
+    }
+    xSemaphoreGive(client->tx_lock);
+
+    if (ret != ESP_OK) {
+        free(frame.data);
+        return ret;
+    }
+    xEventGroupSetBits(client->tx_status, TX_READY_BIT);
+    return ESP_OK;
+}
+
+// Runs on the TX task, or without one on the task sending a packet with attachments. Between the attachments
+// of a binary packet the server accepts nothing but attachments and Engine.IO packets, so Socket.IO frames then
+// wait for the packet to complete.
+static void esp_sio_client_flush_control(esp_socketio_client_handle_t client, bool eio_only)
+{
+    while (true) {
+        esp_sio_control_frame_t frame;
+        xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+        if (client->tx_control_len == 0) {
+            xEventGroupSetBits(client->tx_status, TX_CONTROL_SENT_BIT);
+            xSemaphoreGive(client->tx_lock);
+            return;
+        }
+        frame = client->tx_control[client->tx_control_head];
+        const char *data = (frame.data != NULL) ? frame.data : frame.inline_data;
+        if (eio_only && data[0] == EIO_PACKET_TYPE_MESSAGE) {
+            xSemaphoreGive(client->tx_lock);
+            return;
+        }
+        client->tx_control_head = (client->tx_control_head + 1) % client->tx_control_size;
+        client->tx_control_len--;
+        xSemaphoreGive(client->tx_lock);
+
+        if (esp_sio_client_send_control_frame(client, data, frame.len, frame.ping_time, portMAX_DELAY) != ESP_OK) {
+            ESP_LOGW(TAG, "Dropping control frame");
+        }
+        free(frame.data);
+    }
+}
+
+// Without a TX queue, the control frames of other tasks wait in the control lane while a packet with attachments is
+// sent, as they must not land between its frames. Those already being sent are waited for first, unless this is the
+// receiving task: the WebSocket client then holds its lock, so nothing else is sent until the packet is complete.
+static void esp_sio_client_tx_begin(esp_socketio_client_handle_t client)
+{
+    if (client->tx_queue != NULL) {
+        return;
+    }
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    client->tx_busy = true;
+    bool wait = client->tx_direct_num > 0 && xTaskGetCurrentTaskHandle() != client->rx_task;
+    xSemaphoreGive(client->tx_lock);
+    if (wait) {
+        xEventGroupWaitBits(client->tx_status, TX_DIRECT_IDLE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+}
+
+static void esp_sio_client_tx_end(esp_socketio_client_handle_t client)
+{
+    if (client->tx_queue != NULL) {
+        return;
+    }
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    client->tx_busy = false;
+    xSemaphoreGive(client->tx_lock);
+    esp_sio_client_flush_control(client, false);
+}
+
+static bool esp_sio_client_offline_ready(const char *nsp, void *arg)
+{
+    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)arg;
+    return esp_websocket_client_is_connected(client->ws_client) && esp_socketio_ns_list_is_nsp_exist(client->ns_list, nsp);
+}
+
+static esp_err_t esp_sio_client_offline_send(int index, const uint8_t *data, size_t len, void *arg)
+{
+    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)arg;
+    int sent;
+    if (index == 0) {
+        sent = esp_websocket_client_send_text(client->ws_client, (const char *)data, len, portMAX_DELAY);
+    } else {
+        esp_sio_client_flush_control(client, true);
+        sent = esp_websocket_client_send_bin(client->ws_client, (const char *)data, len, portMAX_DELAY);
+    }
+    return (sent >= 0) ? ESP_OK : ESP_FAIL;
+}
+
+static void esp_sio_client_flush_offline(esp_socketio_client_handle_t client);
+
+static void esp_sio_client_outbox_acked(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet, void *arg)
+{
+    esp_socketio_outbox_ack(client->outbox, (uint32_t)(uintptr_t)arg, packet != NULL);
+    if (packet == NULL && client->tx_queue == NULL) {
+        // Timed out on the esp_timer task, which must not wait for the network: the packets to send again are
+        // drained by the dispatch task, or by the receiving task on its next event
+        xEventGroupSetBits(client->dispatch_status, DISPATCH_OFFLINE_BIT);
+        return;
+    }
+    // Room in the window for the next journaled packet, or the packets to send again after a timeout
+    esp_sio_client_flush_offline(client);
+}
+
+static int esp_sio_client_outbox_track(uint32_t token, void *arg)
+{
+    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)arg;
+    int id = -1;
+    if (esp_socketio_ack_table_add(client->ack_table, CONFIG_ESP_SOCKETIO_OUTBOX_ACK_TIMEOUT_MS,
+                                   esp_sio_client_outbox_acked, (void *)(uintptr_t)token, &id) != ESP_OK) {
+        return -1;
+    }
+    return id;
+}
+
+// Stored packets were not checked against the maxPayload of this connection, nor chunked: those exceeding it are dropped
+static void esp_sio_client_send_offline(esp_socketio_client_handle_t client)
+{
+    size_t max_frame = (client->max_payload > 0) ? client->max_payload : 0;
+    esp_sio_client_tx_begin(client);
+    if (client->outbox != NULL) {
+        int sent = esp_socketio_outbox_drain(client->outbox, max_frame, esp_sio_client_offline_ready, esp_sio_client_outbox_track,
+                                             esp_sio_client_offline_send, client);
+        ESP_LOGD(TAG, "Sent %d journaled packets", sent);
+    } else {
+        int sent = esp_socketio_offline_buffer_flush(client->offline, max_frame, esp_sio_client_offline_ready,
+                                                     esp_sio_client_offline_send, client);
+        if (sent > 0) {
+            ESP_LOGI(TAG, "Sent %d packets buffered while disconnected", sent);
+        }
+    }
+    esp_sio_client_tx_end(client);
+}
+
+// With a TX queue, buffered packets are sent by the TX task, ahead of the queued ones and never between
+// the frames of another packet
+static void esp_sio_client_flush_offline(esp_socketio_client_handle_t client)
+{
+    if (client->offline == NULL && client->outbox == NULL) {
+        return;
+    }
+    if (client->tx_queue != NULL) {
+        xEventGroupSetBits(client->tx_status, TX_OFFLINE_BIT | TX_READY_BIT);
+        return;
+    }
+    esp_sio_client_send_offline(client);
+}
+
+static bool esp_sio_client_is_joined(esp_socketio_client_handle_t client, const char *nsp)
+{
+    xSemaphoreTake(client->session_lock, portMAX_DELAY);
+    esp_sio_session_t *session = esp_sio_client_find_session(client, nsp);
+    bool joined = session != NULL && session->joined;
+    xSemaphoreGive(client->session_lock);
+    return joined;
+}
+
+static esp_err_t esp_sio_client_store_offline(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet)
+{
+    esp_err_t ret = (client->outbox != NULL) ? esp_socketio_outbox_append(client->outbox, packet)
+                    : esp_socketio_offline_buffer_store(client->offline, packet);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    // The namespace may have been connected and the buffer flushed while the packet was stored
+    bool ready = esp_sio_client_offline_ready(esp_socketio_packet_get_nsp(packet), client);
+    esp_socketio_packet_reset(packet);
+    if (ready) {
+        esp_sio_client_flush_offline(client);
+    }
+    return ESP_OK;
+}
+
+static void sio_ping_interval_callback(void* arg)
+{
+    ESP_LOGE(TAG, "Ping timer expired!");
+    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)arg;
+    // Handlers never run on the esp_timer task: SOCKETIO_EVENT_ERROR is dispatched by the dispatch task,
+    // or by the receiving task on its next event, which the WebSocket keepalive guarantees
+    xEventGroupSetBits(client->dispatch_status, DISPATCH_PING_TIMEOUT_BIT);
+}
+
+// Called by the task running the handlers
+static void esp_sio_client_drain_deferred(esp_socketio_client_handle_t client)
+{
+    if (xEventGroupClearBits(client->dispatch_status, DISPATCH_OFFLINE_BIT) & DISPATCH_OFFLINE_BIT) {
+        esp_sio_client_send_offline(client);
+    }
+}
+
+// Called by the task running the handlers
+static void esp_sio_client_report_ping_timeout(esp_socketio_client_handle_t client)
+{
+    if (!(xEventGroupClearBits(client->dispatch_status, DISPATCH_PING_TIMEOUT_BIT) & DISPATCH_PING_TIMEOUT_BIT)) {
+        return;
+    }
+    esp_socketio_event_data_t socketio_event_data;
+    socketio_event_data.websocket_event_id = WEBSOCKET_EVENT_ANY;
+    socketio_event_data.websocket_event = NULL;
+    socketio_event_data.socketio_packet = NULL;
+    socketio_event_data.client = client;
+
+    esp_sio_client_dispatch_event(client, SOCKETIO_EVENT_ERROR, &socketio_event_data, sizeof(esp_socketio_event_data_t));
+}
+
+static uint32_t esp_sio_client_hash_event(const char *nsp, const char *event_name)
+{
+    // FNV-1a over "<nsp>\0<event_name>"
+    uint32_t hash = 2166136261u;
+    for (const char *pos = nsp; *pos != '\0'; pos++) {
+        hash = (hash ^ (uint8_t)*pos) * 16777619u;
+    }
+    hash *= 16777619u;
+    for (const char *pos = event_name; *pos != '\0'; pos++) {
+        hash = (hash ^ (uint8_t)*pos) * 16777619u;
+    }
+    return hash;
+}
+
+// Called with event_lock held
+static esp_sio_event_entry_t *esp_sio_client_find_event(esp_socketio_client_handle_t client, const char *nsp, const char *event_name)
+{
+    if (client->event_num == 0) {
+        return NULL;
+    }
+    uint32_t hash = esp_sio_client_hash_event(nsp, event_name);
+    for (esp_sio_event_entry_t *entry = client->event_table[hash & (client->event_table_size - 1)]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->event_name, event_name) == 0 && strcmp(entry->nsp, nsp) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t esp_sio_client_grow_event_table(esp_socketio_client_handle_t client)
+{
+    size_t new_size = (client->event_table_size == 0) ? SOCKETIO_EVENT_TABLE_MIN_SIZE : client->event_table_size * 2;
+    esp_sio_event_entry_t **new_table = calloc(new_size, sizeof(esp_sio_event_entry_t *));
+    ESP_SOCKETIO_MEM_CHECK(TAG, new_table, return ESP_ERR_NO_MEM);
+
+    for (size_t i = 0; i < client->event_table_size; i++) {
+        esp_sio_event_entry_t *entry = client->event_table[i];
+        while (entry != NULL) {
+            esp_sio_event_entry_t *next = entry->next;
+            size_t bucket = entry->hash & (new_size - 1);
+            entry->next = new_table[bucket];
+            new_table[bucket] = entry;
+            entry = next;
+        }
+    }
+    free(client->event_table);
+    client->event_table = new_table;
+    client->event_table_size = new_size;
+    return ESP_OK;
+}
+
+static esp_sio_event_entry_t *esp_sio_client_add_event(esp_socketio_client_handle_t client, const char *nsp, const char *event_name)
+{
+    esp_sio_event_entry_t *entry = esp_sio_client_find_event(client, nsp, event_name);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    if (client->event_num >= client->event_table_size && esp_sio_client_grow_event_table(client) != ESP_OK) {
+        return NULL;
+    }
+    size_t name_len = strlen(event_name);
+    entry = calloc(1, sizeof(esp_sio_event_entry_t) + name_len + 1);
+    ESP_SOCKETIO_MEM_CHECK(TAG, entry, return NULL);
+    entry->hash = esp_sio_client_hash_event(nsp, event_name);
+    strcpy(entry->nsp, nsp);
+    memcpy(entry->event_name, event_name, name_len + 1);
+
+    size_t bucket = entry->hash & (client->event_table_size - 1);
+    entry->next = client->event_table[bucket];
+    client->event_table[bucket] = entry;
+    client->event_num++;
+    return entry;
+}
+
+static void esp_sio_client_remove_event(esp_socketio_client_handle_t client, esp_sio_event_entry_t *entry)
+{
+    esp_sio_event_entry_t **slot = &client->event_table[entry->hash & (client->event_table_size - 1)];
+    while (*slot != entry) {
+        slot = &(*slot)->next;
+    }
+    *slot = entry->next;
+    free(entry);
+    client->event_num--;
+}
+
+// Ack callback, handler of the event name or SOCKETIO_EVENT_DATA, on the receiving task or the dispatch task
+static void esp_sio_client_deliver_data(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet,
+                                        esp_socketio_event_data_t *socketio_event_data)
+{
+    esp_socketio_packet_type_t sio_type = esp_socketio_packet_get_sio_type(packet);
+    if ((sio_type == SIO_PACKET_TYPE_ACK || sio_type == SIO_PACKET_TYPE_BINARY_ACK)
+        && esp_socketio_ack_table_complete(client->ack_table, packet)) {
+        return;
+    }
+
+    // Copied under the lock and called after it, so the handler can register events
+    esp_socketio_event_handler_t handler = NULL;
+    void *handler_arg = NULL;
+    const char *event_name = esp_socketio_packet_get_event_name(packet);
+    if (event_name != NULL) {
+        xSemaphoreTake(client->event_lock, portMAX_DELAY);
+        const esp_sio_event_entry_t *entry = esp_sio_client_find_event(client, esp_socketio_packet_get_nsp(packet), event_name);
+        if (entry != NULL) {
+            handler = entry->handler;
+            handler_arg = entry->handler_arg;
+        }
+        xSemaphoreGive(client->event_lock);
+    }
+
+    if (handler != NULL) {
+        handler(client, packet, handler_arg);
+        return;
+    }
+    socketio_event_data->socketio_packet = packet;
+    esp_sio_client_dispatch_event(client, SOCKETIO_EVENT_DATA, socketio_event_data, sizeof(esp_socketio_event_data_t));
+}
+
+static void esp_sio_client_dispatch_data(esp_socketio_client_handle_t client, esp_socketio_event_data_t *socketio_event_data)
+{
+    esp_socketio_packet_type_t sio_type = esp_socketio_packet_get_sio_type(client->rx_packet);
+    if (sio_type == SIO_PACKET_TYPE_EVENT || sio_type == SIO_PACKET_TYPE_BINARY_EVENT) {
+        // Session state stays on the receiving task, which reconnects with it
+        esp_sio_client_record_offset(client, client->rx_packet);
+    }
+    if (client->dispatch_task != NULL) {
+        esp_sio_client_dispatch_post(client, SOCKETIO_EVENT_DATA, true);
+        return;
+    }
+    esp_sio_client_deliver_data(client, client->rx_packet, socketio_event_data);
+}
+
+static void esp_sio_client_select_binary_sink(esp_socketio_client_handle_t client)
+{
+    client->rx_sink = NULL;
+    client->rx_sink_index = 0;
+    client->rx_sink_offset = 0;
+    client->rx_sink_failed = false;
+    const char *event_name = esp_socketio_packet_get_event_name(client->rx_packet);
+    if (esp_socketio_packet_get_sio_type(client->rx_packet) != SIO_PACKET_TYPE_BINARY_EVENT || event_name == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(client->event_lock, portMAX_DELAY);
+    const esp_sio_event_entry_t *entry = esp_sio_client_find_event(client, esp_socketio_packet_get_nsp(client->rx_packet), event_name);
+    if (entry != NULL) {
+        client->rx_sink = entry->sink;
+        client->rx_sink_arg = entry->sink_arg;
+        client->rx_sink_id = entry->sink_id;
+    }
+    xSemaphoreGive(client->event_lock);
+}
+
+// The sink of the current event may be removed or replaced by the application while its attachments arrive
+static bool esp_sio_client_is_sink_registered(esp_socketio_client_handle_t client)
+{
+    xSemaphoreTake(client->event_lock, portMAX_DELAY);
+    const esp_sio_event_entry_t *entry = esp_sio_client_find_event(client, esp_socketio_packet_get_nsp(client->rx_packet),
+                                                                   esp_socketio_packet_get_event_name(client->rx_packet));
+    bool registered = entry != NULL && entry->sink_id == client->rx_sink_id;
+    xSemaphoreGive(client->event_lock);
+    return registered;
+}
+
+// A handler retained the previous packet: leave it to its last release and parse into another one
+static bool esp_sio_client_take_rx_packet(esp_socketio_client_handle_t client)
+{
+    if (!esp_socketio_packet_is_shared(client->rx_packet)) {
+        return true;
+    }
+    esp_socketio_packet_handle_t packet = esp_socketio_packet_pool_get(client->packet_pool);
+    if (packet == NULL) {
+        return false;
+    }
+    esp_socketio_packet_release(client->rx_packet);
+    client->rx_packet = packet;
+    return true;
+}
+
+static void esp_sio_client_handle_text(esp_socketio_client_handle_t client, const char *buf, int len,
+        esp_socketio_event_data_t *socketio_event_data)
+{
+    if (SOCKETIO_STATE_HANDSHAKE == client->socketio_state) {
+        if (EIO_PACKET_TYPE_OPEN == buf[0]) {
+            if (esp_socketio_parse_open_packet(
+                    &buf[1],
+                    len - 1,
+                    client->sid,
+                    &client->ping_interval,
+                    &client->ping_timeout,
+                    &client->max_payload
+                ) == ESP_OK) {
+                ESP_LOGI(TAG, "Start Socket.IO ping timer: %d ms", (client->ping_interval + client->ping_timeout));
+                ESP_ERROR_CHECK(esp_timer_start_once(client->sio_ping_timer, (client->ping_interval + client->ping_timeout) * 1000));
+                // Send event OPEN
+                client->socketio_state = SOCKETIO_STATE_OPENED;
+                client->reconnect_attempt = 0;
+                esp_sio_client_connect_sessions(client);
+                esp_sio_client_notify(client, SOCKETIO_EVENT_OPENED, socketio_event_data);
+            }
+        }
+    }
+
+    if ((SOCKETIO_STATE_OPENED == client->socketio_state || SOCKETIO_STATE_CONNECTED == client->socketio_state)) {
+        if (EIO_PACKET_TYPE_MESSAGE == buf[0]) {
+            if (!esp_sio_client_take_rx_packet(client)) {
+                ESP_LOGE(TAG, "No packet to parse message into, dropping it");
+                return;
+            }
+            if (esp_socketio_packet_parse_message(client->rx_packet, buf, len) != ESP_OK) {
+                ESP_LOGE(TAG, "Error parsing message.");
+                return;
+            }
+            char *nsp = esp_socketio_packet_get_nsp(client->rx_packet);
+            esp_socketio_packet_type_t sio_type = esp_socketio_packet_get_sio_type(client->rx_packet);
+            switch (sio_type)
+            {
+            case SIO_PACKET_TYPE_CONNECT:
+                client->socketio_state = SOCKETIO_STATE_CONNECTED;
+                cJSON *json_sid = cJSON_GetObjectItem(esp_socketio_packet_get_json(client->rx_packet), "sid");
+                if (!(cJSON_IsString(json_sid) && json_sid->valuestring != NULL)) {
+                    ESP_LOGE(TAG, "Error! No Socket.IO data found in CONNECT message.");
+                    break;
+                }
+                ESP_LOGI(TAG, "Add namespace: %s, sid: %s", (nsp == NULL)? "/" : nsp, json_sid->valuestring);
+                esp_socketio_ns_list_add_ns(client->ns_list, nsp, json_sid->valuestring);
+                esp_sio_client_session_connected(client, nsp, esp_socketio_packet_get_json(client->rx_packet));
+                esp_sio_client_flush_offline(client);
+                socketio_event_data->socketio_packet = client->rx_packet;
+                esp_sio_client_notify(client, SOCKETIO_EVENT_NS_CONNECTED, socketio_event_data);
+                esp_sio_client_check_configured(client, socketio_event_data);
+                break;
+
+            case SIO_PACKET_TYPE_DISCONNECT: {
+                // Disconnected by the server: not joined again after a reconnection
+                xSemaphoreTake(client->session_lock, portMAX_DELAY);
+                esp_sio_session_t *session = esp_sio_client_find_session(client, nsp);
+                if (session != NULL) {
+                    session->joined = false;
+                    session->connecting = false;
+                }
+                xSemaphoreGive(client->session_lock);
+                if (esp_socketio_ns_list_delete_ns(client->ns_list, nsp) == ESP_ERR_NOT_FOUND) {
+                    ESP_LOGE(TAG, "Namespace not found");
+                }
+                if (esp_socketio_ns_list_get_num(client->ns_list) <= 0) {
+                    client->socketio_state = SOCKETIO_STATE_DISCONNECTED;
+                }
+                break;
+            }
+
+            case SIO_PACKET_TYPE_EVENT:
+            case SIO_PACKET_TYPE_ACK:
+                esp_sio_client_dispatch_data(client, socketio_event_data);
+                break;
+
+            case SIO_PACKET_TYPE_BINARY_EVENT:
+            case SIO_PACKET_TYPE_BINARY_ACK:
+                client->socketio_state = SOCKETIO_STATE_WAIT_FOR_BINARY;
+                esp_sio_client_select_binary_sink(client);
+                break;
+
+            case SIO_PACKET_TYPE_CONNECT_ERROR:
+                ESP_LOGE(TAG, "Received CONNECT_ERROR");
+                // esp_socketio_client_connect_nsp can try again
+                esp_sio_client_set_connecting(client, nsp, false);
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    if (EIO_PACKET_TYPE_PING == buf[0] && len == 1) {
+        ESP_LOGD(TAG, "Receive Engine.IO PING, sending PONG");
+        esp_timer_stop(client->sio_ping_timer);
+        char pong = EIO_PACKET_TYPE_PONG;
+        if (esp_sio_client_send_control(client, &pong, 1, esp_timer_get_time()) != ESP_OK) {
+            ESP_LOGE(TAG, "Send PONG failed");
+        }
+        esp_timer_start_once(client->sio_ping_timer, (client->ping_interval + client->ping_timeout) * 1000);
+    }
+}
+
+static void esp_sio_client_handle_binary(esp_socketio_client_handle_t client, const char *buf, int len,
+        esp_socketio_event_data_t *socketio_event_data)
+{
+    ESP_LOGI(TAG, "Received binary");
+    esp_socketio_packet_add_binary_data(client->rx_packet, (const unsigned char *)buf, len, false);
+    if (esp_socketio_packet_count_binary_data(client->rx_packet) == esp_socketio_packet_get_last_binary_index(client->rx_packet) + 1) {
+        client->socketio_state = SOCKETIO_STATE_CONNECTED;
+        esp_sio_client_dispatch_data(client, socketio_event_data);
+    }
+}
+
+static void esp_sio_client_handle_message(esp_socketio_client_handle_t client, uint8_t op_code, const char *buf, int len,
+        esp_socketio_event_data_t *socketio_event_data)
+{
+    if (len <= 0) {
+        return;
+    }
+
+    if (op_code == WS_TRANSPORT_OPCODES_TEXT) {
+        esp_sio_client_handle_text(client, buf, len, socketio_event_data);
+    } else if (op_code == WS_TRANSPORT_OPCODES_BINARY && client->socketio_state == SOCKETIO_STATE_WAIT_FOR_BINARY) {
+        esp_sio_client_handle_binary(client, buf, len, socketio_event_data);
+    }
+}
+
+static void esp_sio_client_reset_rx_message(esp_socketio_client_handle_t client)
+{
+    client->rx_len = 0;
+    client->rx_op_code = 0;
+    client->rx_discard = false;
+}
+
+static esp_err_t esp_sio_client_append_rx_message(esp_socketio_client_handle_t client, const char *data, size_t len, size_t expected_len)
+{
+    size_t needed = client->rx_len + ((expected_len > len) ? expected_len : len);
+    if (needed > client->rx_max_message_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Keep room for a NUL terminator so the message can be handled as a string
+    if (needed + 1 > client->rx_buffer_size) {
+        size_t new_size = client->rx_buffer_size * 2;
+        if (new_size < needed + 1) {
+            new_size = needed + 1;
+        }
+        if (new_size > client->rx_max_message_size + 1) {
+            new_size = client->rx_max_message_size + 1;
+        }
+        char *new_buffer = realloc(client->rx_buffer, new_size);
+        ESP_SOCKETIO_MEM_CHECK(TAG, new_buffer, return ESP_ERR_NO_MEM);
+        client->rx_buffer = new_buffer;
+        client->rx_buffer_size = new_size;
+    }
+
+    memcpy(client->rx_buffer + client->rx_len, data, len);
+    client->rx_len += len;
+    client->rx_buffer[client->rx_len] = '\0';
+    return ESP_OK;
+}
+
+static void esp_sio_client_stream_binary(esp_socketio_client_handle_t client, esp_websocket_event_data_t *data,
+        esp_socketio_event_data_t *socketio_event_data)
+{
+    if (data->op_code == WS_TRANSPORT_OPCODES_BINARY && data->payload_offset == 0) {
+        client->rx_op_code = WS_TRANSPORT_OPCODES_BINARY;
+        client->rx_sink_offset = 0;
+        client->rx_sink_total = data->fin ? data->payload_len : 0;
+    } else if (client->rx_op_code != WS_TRANSPORT_OPCODES_BINARY) {
+        ESP_LOGW(TAG, "Discarding fragment without start of attachment");
+        return;
+    }
+
+    if (!client->rx_sink_failed && !esp_sio_client_is_sink_registered(client)) {
+        // Its attachments are not stored, the event cannot be dispatched without them
+        ESP_LOGW(TAG, "Binary sink of \"%s\" removed on attachment %d, dropping event",
+                 esp_socketio_packet_get_event_name(client->rx_packet), client->rx_sink_index);
+        client->rx_sink_failed = true;
+    }
+    if (!client->rx_sink_failed && client->rx_sink(client->rx_packet, client->rx_sink_index, client->rx_sink_offset,
+                                                   (const unsigned char *)data->data_ptr, data->data_len,
+                                                   client->rx_sink_total, client->rx_sink_arg) != ESP_OK) {
+        ESP_LOGE(TAG, "Binary sink failed on attachment %d, dropping event", client->rx_sink_index);
+        client->rx_sink_failed = true;
+    }
+    client->rx_sink_offset += data->data_len;
+
+    if (data->payload_offset + data->data_len < data->payload_len || !data->fin) {
+        return;
+    }
+
+    client->rx_op_code = 0;
+    client->rx_sink_offset = 0;
+    if (++client->rx_sink_index >= esp_socketio_packet_count_binary_data(client->rx_packet)) {
+        client->socketio_state = SOCKETIO_STATE_CONNECTED;
+        client->rx_sink = NULL;
+        if (!client->rx_sink_failed) {
+            esp_sio_client_dispatch_data(client, socketio_event_data);
+        }
+    }
+}
+
+static void esp_sio_client_receive_data(esp_socketio_client_handle_t client, esp_websocket_event_data_t *data,
+                                        esp_socketio_event_data_t *socketio_event_data)
+{
+    bool frame_done = data->payload_offset + data->data_len >= data->payload_len;
+    bool message_done = frame_done && data->fin;
+
+    if (client->rx_sink != NULL && client->socketio_state == SOCKETIO_STATE_WAIT_FOR_BINARY
+        && (data->op_code == WS_TRANSPORT_OPCODES_BINARY || data->op_code == WS_TRANSPORT_OPCODES_CONT)) {
+        // Attachments of a streamed event bypass the reassembly buffer
+        esp_sio_client_stream_binary(client, data, socketio_event_data);
+        return;
+    }
+
+    if (data->op_code == WS_TRANSPORT_OPCODES_TEXT || data->op_code == WS_TRANSPORT_OPCODES_BINARY) {
+        if (data->payload_offset == 0) {
+            if (client->rx_op_code != 0) {
+                ESP_LOGW(TAG, "Discarding incomplete message (%d bytes received)", (int)client->rx_len);
+            }
+            esp_sio_client_reset_rx_message(client);
+            if (message_done) {
+                // The whole message is in the receive buffer of the WebSocket client, no copy needed
+                esp_sio_client_handle_message(client, data->op_code, data->data_ptr, data->data_len, socketio_event_data);
+                return;
+            }
+            client->rx_op_code = data->op_code;
+        }
+    } else if (data->op_code != WS_TRANSPORT_OPCODES_CONT) {
+        return;
+    }
+
+    if (client->rx_op_code == 0) {
+        ESP_LOGW(TAG, "Discarding fragment without start of message");
+        return;
+    }
+
+    if (!client->rx_discard) {
+        size_t expected_len = (data->payload_offset == 0) ? data->payload_len : 0;
+        esp_err_t err = esp_sio_client_append_rx_message(client, data->data_ptr, data->data_len, expected_len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Discarding message exceeding %d bytes: %s", (int)client->rx_max_message_size, esp_err_to_name(err));
+            client->rx_discard = true;
+            client->rx_len = 0;
+        }
+    }
+
+    if (message_done) {
+        if (!client->rx_discard) {
+            esp_sio_client_handle_message(client, client->rx_op_code, client->rx_buffer, client->rx_len, socketio_event_data);
+        }
+        esp_sio_client_reset_rx_message(client);
+    }
+}
+
+static void websocket_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_websocket_event_data_t *data = (esp_websocket_event_data_t *)event_data;
+    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)handler_args;
+    client->rx_task = xTaskGetCurrentTaskHandle();
+    esp_socketio_event_data_t socketio_event_data;
+    socketio_event_data.websocket_event_id = event_id;
+    socketio_event_data.websocket_event = data;
+    socketio_event_data.socketio_packet = NULL;
+    socketio_event_data.client = client;
+
+    if (client->dispatch_task == NULL) {
+        esp_sio_client_report_ping_timeout(client);
+        esp_sio_client_drain_deferred(client);
+    }
+
+    switch (event_id) {
+    case WEBSOCKET_EVENT_DATA:
+        ESP_LOGD(TAG, "WEBSOCKET_EVENT_DATA");
+        ESP_LOGD(TAG, "Received opcode=%d", data->op_code);
+        if (data->op_code == WS_TRANSPORT_OPCODES_CLOSE && data->data_len == 2) {
+            ESP_LOGW(TAG, "Received closed message with code=%d", 256 * data->data_ptr[0] + data->data_ptr[1]);
+        } else {
+            ESP_LOGD(TAG, "Received=%.*s", data->data_len, (char *)data->data_ptr);
+        }
+
+        if (data->op_code == WS_TRANSPORT_OPCODES_PONG) {
+            ESP_LOGD(TAG, "Received WS PONG");
+        }
+
+        ESP_LOGD(TAG, "Total payload length=%d, data_len=%d, current payload offset=%d\r\n", data->payload_len, data->data_len, data->payload_offset);
+
+        esp_sio_client_receive_data(client, data, &socketio_event_data);
+        break;
+
+    case WEBSOCKET_EVENT_DISCONNECTED:
+        esp_sio_client_reset_rx_message(client);
+        client->rx_sink = NULL;
+        if (client->socketio_state != SOCKETIO_STATE_INIT && client->socketio_state != SOCKETIO_STATE_CLOSED) {
+            // The WebSocket client reconnects by itself; the Engine.IO handshake and the namespaces follow
+            esp_timer_stop(client->sio_ping_timer);
+            esp_socketio_ns_list_clear(client->ns_list);
+            xSemaphoreTake(client->session_lock, portMAX_DELAY);
+            for (size_t i = 0; i < client->session_num; i++) {
+                client->sessions[i]->connecting = false;
+            }
+            xSemaphoreGive(client->session_lock);
+            client->socketio_state = SOCKETIO_STATE_HANDSHAKE;
+            esp_sio_client_schedule_reconnect(client);
+        }
+        break;
+    }
+    return;
+}
+
+// The server waits for the attachments announced by a packet whose text frame is sent, and a started message cannot be
+// cancelled. A close frame, allowed between the fragments of a message, makes the server drop the packet with the
+// connection, which is then opened again like after any disconnection.
+static void esp_sio_client_abort_message(esp_socketio_client_handle_t client)
+{
+    static const uint8_t close_code[] = { 0x03, 0xf3 };    // 1011, internal error
+    esp_websocket_client_send_with_opcode(client->ws_client, WS_TRANSPORT_OPCODES_CLOSE, close_code, sizeof(close_code),
+                                          portMAX_DELAY);
+}
+
+static esp_err_t esp_sio_client_send_binary_stream(esp_socketio_client_handle_t client,
+        esp_socketio_binary_reader_cb_t reader, void *reader_arg, size_t data_size)
+{
+    if (client->tx_chunk_buffer == NULL) {
+        client->tx_chunk_buffer = malloc(CONFIG_ESP_SOCKETIO_TX_CHUNK_SIZE);
+        ESP_SOCKETIO_MEM_CHECK(TAG, client->tx_chunk_buffer, return ESP_ERR_NO_MEM);
+    }
+
+    size_t offset = 0;
+    do {
+        size_t chunk_len = data_size - offset;
+        if (chunk_len > CONFIG_ESP_SOCKETIO_TX_CHUNK_SIZE) {
+            chunk_len = CONFIG_ESP_SOCKETIO_TX_CHUNK_SIZE;
+        }
+        int read_len = (chunk_len == 0) ? 0 : reader(client->tx_chunk_buffer, offset, chunk_len, reader_arg);
+        if (read_len < 0 || (size_t)read_len > chunk_len || (read_len == 0 && chunk_len > 0)) {
+            ESP_LOGE(TAG, "Binary reader failed at offset %d, closing the connection", (int)offset);
+            esp_sio_client_abort_message(client);
+            return ESP_FAIL;
+        }
+
+        int sent;
+        if (offset == 0 && (size_t)read_len == data_size) {
+            // Fits in one chunk, no need to fragment
+            sent = esp_websocket_client_send_bin(client->ws_client, (const char *)client->tx_chunk_buffer, read_len, portMAX_DELAY);
+            return (sent >= 0) ? ESP_OK : ESP_FAIL;
+        } else if (offset == 0) {
+            sent = esp_websocket_client_send_bin_partial(client->ws_client, (const char *)client->tx_chunk_buffer, read_len, portMAX_DELAY);
+        } else {
+            sent = esp_websocket_client_send_cont_msg(client->ws_client, (const char *)client->tx_chunk_buffer, read_len, portMAX_DELAY);
+        }
+        if (sent < 0) {
+            return ESP_FAIL;
+        }
+        offset += read_len;
+    } while (offset < data_size);
+
+    return (esp_websocket_client_send_fin(client->ws_client, portMAX_DELAY) == ESP_OK) ? ESP_OK : ESP_FAIL;
+}
+
+// Engine.IO closes the connection on a WebSocket message larger than maxPayload, unknown before OPEN
+static bool esp_sio_client_fits_payload(esp_socketio_client_handle_t client, size_t len)
+{
+    return client->max_payload <= 0 || len <= (size_t)client->max_payload;
+}
+
+static size_t esp_sio_client_attachment_size(esp_socketio_packet_handle_t packet, int index)
+{
+    unsigned char *binary = NULL;
+    size_t binary_size = 0;
+    esp_socketio_binary_reader_cb_t reader = NULL;
+    void *reader_arg = NULL;
+    if (esp_socketio_packet_get_binary_data(packet, index, &binary, &binary_size) != ESP_OK) {
+        esp_socketio_packet_get_binary_reader(packet, index, &reader, &reader_arg, &binary_size);
+    }
+    return binary_size;
+}
+
+// Check the attachments against maxPayload, before anything is sent or queued
+static esp_err_t esp_sio_client_check_attachments(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet,
+        bool *chunked_ptr)
+{
+    *chunked_ptr = false;
+    int binary_count = esp_socketio_packet_count_binary_data(packet);
+    for (int i = 0; i < binary_count; i++) {
+        size_t binary_size = esp_sio_client_attachment_size(packet, i);
+        if (esp_sio_client_fits_payload(client, binary_size)) {
+            continue;
+        }
+        if (!client->chunked_transfer) {
+            ESP_LOGE(TAG, "Attachment of %d bytes larger than maxPayload (%d)", (int)binary_size, client->max_payload);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *chunked_ptr = true;
+    }
+    return ESP_OK;
+}
+
+typedef struct {
+    esp_socketio_binary_reader_cb_t reader;
+    void                            *arg;
+    size_t                          base;
+} esp_sio_chunk_reader_t;
+
+static int esp_sio_client_read_chunk(unsigned char *buf, size_t offset, size_t len, void *arg)
+{
+    esp_sio_chunk_reader_t *chunk = (esp_sio_chunk_reader_t *)arg;
+    return chunk->reader(buf, chunk->base + offset, len, chunk->arg);
+}
+
+static esp_err_t esp_sio_client_send_chunk_text(esp_socketio_client_handle_t client, const esp_socketio_packet_header_t *header,
+        const char *fmt, ...)
+{
+    char text[ESP_SOCKETIO_NSP_MAX_LEN + SOCKETIO_CHUNK_TEXT_SIZE];
+    size_t len = 0;
+    esp_err_t ret = esp_socketio_packet_encode_header(header, text, sizeof(text), &len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int written = vsnprintf(text + len, sizeof(text) - len, fmt, args);
+    va_end(args);
+    if (written < 0 || (size_t)written >= sizeof(text) - len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    len += written;
+    return (esp_websocket_client_send_text(client->ws_client, text, len, portMAX_DELAY) < 0) ? ESP_FAIL : ESP_OK;
+}
+
+/*
+ * Send a packet whose attachments exceed maxPayload as "sio-chunk" events, reassembled by the server
+ * (see examples/test_server/server.js):
+ *     ["sio-chunk", {"id": <id>, "sizes": [<attachment sizes>], "data": <original arguments, with placeholders>}]
+ * then, for every slice of every attachment, in order, a binary event
+ *     ["sio-chunk", {"id": <id>, "seq": <1, 2, ...>, "index": <attachment>, "offset": <offset>}, <slice>]
+ * The last one carries the ack id of the original packet.
+ */
+static esp_err_t esp_sio_client_transmit_chunked(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet,
+        const char *data, int data_len)
+{
+    esp_socketio_packet_header_t header;
+    esp_err_t ret = esp_socketio_packet_parse_header(data, data_len, &header);
+    if (ret != ESP_OK || header.payload == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int binary_count = esp_socketio_packet_count_binary_data(packet);
+    uint32_t id = client->chunk_id++;
+
+    // Header message, built around the encoded arguments
+    size_t capacity = header.nsp_len + SOCKETIO_CHUNK_TEXT_SIZE + binary_count * 11 + header.payload_len;
+    char *text = malloc(capacity);
+    ESP_SOCKETIO_MEM_CHECK(TAG, text, return ESP_ERR_NO_MEM);
+    esp_socketio_packet_header_t sub_header = {
+        .eio_type = EIO_PACKET_TYPE_MESSAGE,
+        .sio_type = SIO_PACKET_TYPE_EVENT,
+        .nsp = header.nsp,
+        .nsp_len = header.nsp_len,
+        .event_id = -1,
+    };
+    size_t len = 0;
+    ret = esp_socketio_packet_encode_header(&sub_header, text, capacity, &len);
+    if (ret == ESP_OK) {
+        len += sprintf(text + len, "[\"" SOCKETIO_CHUNK_EVENT "\",{\"id\":%" PRIu32 ",\"sizes\":[", id);
+        for (int i = 0; i < binary_count; i++) {
+            len += sprintf(text + len, (i == 0) ? "%u" : ",%u", (unsigned)esp_sio_client_attachment_size(packet, i));
+        }
+        len += sprintf(text + len, "],\"data\":");
+        memcpy(text + len, header.payload, header.payload_len);
+        len += header.payload_len;
+        text[len++] = '}';
+        text[len++] = ']';
+        if (!esp_sio_client_fits_payload(client, len)) {
+            ESP_LOGE(TAG, "Chunked packet header of %d bytes larger than maxPayload (%d)", (int)len, client->max_payload);
+            ret = ESP_ERR_INVALID_SIZE;
+        } else if (esp_websocket_client_send_text(client->ws_client, text, len, portMAX_DELAY) < 0) {
+            ret = ESP_FAIL;
+        }
+    }
+    free(text);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    uint32_t seq = 0;
+    size_t chunk_size = client->max_payload;
+    sub_header.sio_type = SIO_PACKET_TYPE_BINARY_EVENT;
+    sub_header.binary_count = 1;
+    for (int i = 0; i < binary_count && ret == ESP_OK; i++) {
+        unsigned char *binary = NULL;
+        size_t binary_size = 0;
+        esp_sio_chunk_reader_t chunk_reader = { 0 };
+        if (esp_socketio_packet_get_binary_data(packet, i, &binary, &binary_size) != ESP_OK) {
+            esp_socketio_packet_get_binary_reader(packet, i, &chunk_reader.reader, &chunk_reader.arg, &binary_size);
+        }
+
+        size_t offset = 0;
+        do {
+            size_t chunk_len = (binary_size - offset > chunk_size) ? chunk_size : binary_size - offset;
+            bool last = (i == binary_count - 1 && offset + chunk_len == binary_size);
+            sub_header.event_id = last ? header.event_id : -1;
+            ret = esp_sio_client_send_chunk_text(client, &sub_header,
+                                                 "[\"" SOCKETIO_CHUNK_EVENT "\",{\"id\":%" PRIu32 ",\"seq\":%" PRIu32 ",\"index\":%d,\"offset\":%u},"
+                                                 "{\"_placeholder\":true,\"num\":0}]", id, ++seq, i, (unsigned)offset);
+            if (ret != ESP_OK) {
+                break;
+            }
+            esp_sio_client_flush_control(client, true);
+            if (binary != NULL) {
+                ret = (esp_websocket_client_send_bin(client->ws_client, (const char *)binary + offset, chunk_len, portMAX_DELAY) < 0)
+                      ? ESP_FAIL : ESP_OK;
+            } else {
+                chunk_reader.base = offset;
+                ret = esp_sio_client_send_binary_stream(client, esp_sio_client_read_chunk, &chunk_reader, chunk_len);
+            }
+            offset += chunk_len;
+        } while (offset < binary_size && ret == ESP_OK);
+        esp_socketio_packet_release_binary_data_ref(packet, i);
+    }
+    return ret;
+}
+
+static esp_err_t esp_sio_client_send_frames(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet,
+        const char *data, int data_len);
+
+static esp_err_t esp_sio_client_transmit(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet)
+{
+    esp_err_t ret = esp_socketio_packet_encode_message(packet);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    int data_len = 0;
+    char *data = esp_socketio_packet_get_raw_data(packet, &data_len);
+    if (!esp_sio_client_fits_payload(client, data_len)) {
+        ESP_LOGE(TAG, "Packet of %d bytes larger than maxPayload (%d)", data_len, client->max_payload);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    bool chunked = false;
+    ret = esp_sio_client_check_attachments(client, packet, &chunked);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    int binary_count = esp_socketio_packet_count_binary_data(packet);
+    if (binary_count > 0) {
+        esp_sio_client_tx_begin(client);
+    }
+    ret = chunked ? esp_sio_client_transmit_chunked(client, packet, data, data_len)
+          : esp_sio_client_send_frames(client, packet, data, data_len);
+    if (binary_count > 0) {
+        esp_sio_client_tx_end(client);
+    }
+    return ret;
+}
+
+static esp_err_t esp_sio_client_send_frames(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet,
+        const char *data, int data_len)
 {
-    esp_err_t err;
+    esp_err_t ret = ESP_OK;
+    if (esp_websocket_client_send_text(client->ws_client, data, data_len, portMAX_DELAY) < 0) {
+        ESP_LOGE(TAG, "Send data failed.");
+        ret = ESP_FAIL;
+    }
+    int binary_count = esp_socketio_packet_count_binary_data(packet);
+    unsigned char *binary = NULL;
+    size_t binary_size = 0;
+    esp_socketio_binary_reader_cb_t reader = NULL;
+    void *reader_arg = NULL;
+    for (int i = 0; i < binary_count; i++) {
+        if (ret == ESP_OK) {
+            esp_sio_client_flush_control(client, true);
+            if (esp_socketio_packet_get_binary_data(packet, i, &binary, &binary_size) == ESP_OK) {
+                if (esp_websocket_client_send_bin(client->ws_client, (const char *)binary, (int)binary_size, portMAX_DELAY) < 0) {
+                    ESP_LOGE(TAG, "Failed to send attachment %d", i);
+                    ret = ESP_FAIL;
+                }
+            } else if (esp_socketio_packet_get_binary_reader(packet, i, &reader, &reader_arg, &binary_size) != ESP_OK
+                       || esp_sio_client_send_binary_stream(client, reader, reader_arg, binary_size) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to stream attachment %d", i);
+                ret = ESP_FAIL;
+            }
+        }
+        // Attachments added by reference are handed back as soon as the transport is done with them,
+        // or once sending has failed
+        esp_socketio_packet_release_binary_data_ref(packet, i);
+    }
+    return ret;
+}
 
-    if ((err = esp_event_post_to(client->event_handle,
-                                 SOCKETIO_EVENTS, event,
-                                 data,
-                                 sizeof(esp_socketio_event_data_t),
-                                 portMAX_DELAY)) != ESP_OK) {
-        return err;
+static esp_socketio_packet_handle_t esp_sio_client_tx_acquire(esp_socketio_client_handle_t client)
+{
+    esp_socketio_packet_handle_t packet = NULL;
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    if (client->tx_free_num > 0) {
+        packet = client->tx_free[--client->tx_free_num];
     }
-    return esp_event_loop_run(client->event_handle, 0);
+    xSemaphoreGive(client->tx_lock);
+    return packet;
 }
 
-static void sio_ping_interval_callback(void* arg)
+static void esp_sio_client_tx_release(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet)
 {
-    ESP_LOGE(TAG, "Ping timer expired!");
-    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)arg;
-    esp_socketio_event_data_t socketio_event_data;
-    socketio_event_data.websocket_event_id = WEBSOCKET_EVENT_ANY;
-    socketio_event_data.websocket_event = NULL;
-    socketio_event_data.socketio_packet = NULL;
-    socketio_event_data.client = client;
+    esp_socketio_packet_reset(packet);
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    client->tx_free[client->tx_free_num++] = packet;
+    xSemaphoreGive(client->tx_lock);
+}
 
-    esp_sio_client_dispatch_event(client, SOCKETIO_EVENT_ERROR, &socketio_event_data, sizeof(esp_socketio_event_data_t));
+static void esp_sio_client_tx_push(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet)
+{
+    // The ring has room for every packet of the pool, so pushing an acquired packet cannot fail
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    client->tx_queue[(client->tx_queue_head + client->tx_queue_len) % client->tx_queue_size] = packet;
+    client->tx_queue_len++;
+    xSemaphoreGive(client->tx_lock);
+    xEventGroupSetBits(client->tx_status, TX_READY_BIT);
 }
 
-static void websocket_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+// Swap the contents of the queued packet matching the namespace and event name of `packet` with it.
+// Packets waiting for an ack are not replaced, their ack slot would never be completed.
+static bool esp_sio_client_tx_coalesce(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet)
 {
-    esp_websocket_event_data_t *data = (esp_websocket_event_data_t *)event_data;
-    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)handler_args;
-    esp_socketio_event_data_t socketio_event_data;
-    socketio_event_data.websocket_event_id = event_id;
-    socketio_event_data.websocket_event = data;
-    socketio_event_data.socketio_packet = NULL;
-    socketio_event_data.client = client;
+    const char *event_name = esp_socketio_packet_get_event_name(packet);
+    if (event_name == NULL) {
+        return false;
+    }
+    const char *nsp = esp_socketio_packet_get_nsp(packet);
 
-    switch (event_id) {
-    case WEBSOCKET_EVENT_DATA:
-        ESP_LOGI(TAG, "WEBSOCKET_EVENT_DATA");
-        ESP_LOGI(TAG, "Received opcode=%d", data->op_code);
-        if (data->op_code == WS_TRANSPORT_OPCODES_CLOSE && data->data_len == 2) {
-            ESP_LOGW(TAG, "Received closed message with code=%d", 256 * data->data_ptr[0] + data->data_ptr[1]);
-        } else {
-            ESP_LOGW(TAG, "Received=%.*s", data->data_len, (char *)data->data_ptr);
+    bool replaced = false;
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    // Packets popped by the TX task are no longer in the ring, so only unsent packets are matched
+    for (size_t i = 0; i < client->tx_queue_len && !replaced; i++) {
+        esp_socketio_packet_handle_t queued = client->tx_queue[(client->tx_queue_head + i) % client->tx_queue_size];
+        const char *queued_name = esp_socketio_packet_get_event_name(queued);
+        if (queued_name != NULL && esp_socketio_packet_get_event_id(queued) < 0 && strcmp(queued_name, event_name) == 0
+            && strcmp(esp_socketio_packet_get_nsp(queued), nsp) == 0) {
+            esp_socketio_packet_swap(queued, packet);
+            replaced = true;
         }
+    }
+    xSemaphoreGive(client->tx_lock);
+    return replaced;
+}
 
-        if (data->op_code == WS_TRANSPORT_OPCODES_PONG) {
-            ESP_LOGW(TAG, "Received WS PONG");
-        }
-
-        ESP_LOGI(TAG, "Total payload length=%d, data_len=%d, current payload offset=%d\r\n", data->payload_len, data->data_len, data->payload_offset);
-
-        if (data->payload_len == data->data_len && data->payload_len > 0) {
-            if (data->op_code == WS_TRANSPORT_OPCODES_TEXT) {
-                if (SOCKETIO_STATE_HANDSHAKE == client->socketio_state) {
-                    if (EIO_PACKET_TYPE_OPEN == data->data_ptr[0]) {
-                        if (esp_socketio_parse_open_packet(
-                                &data->data_ptr[1],
-                                data->data_len - 1,
-                                client->sid,
-                                &client->ping_interval,
-                                &client->ping_timeout,
-                                &client->max_payload
-                            ) == ESP_OK) {
-                            ESP_LOGI(TAG, "Start Socket.IO ping timer: %d ms", (client->ping_interval + client->ping_timeout));
-                            ESP_ERROR_CHECK(esp_timer_start_once(client->sio_ping_timer, (client->ping_interval + client->ping_timeout) * 1000));
-                            // Send event OPEN
-                            client->socketio_state = SOCKETIO_STATE_OPENED;
-                            esp_sio_client_dispatch_event(client, SOCKETIO_EVENT_OPENED, &socketio_event_data, sizeof(esp_socketio_event_data_t));
-                        }
-                    }
-                }
+static esp_socketio_packet_handle_t esp_sio_client_tx_pop(esp_socketio_client_handle_t client)
+{
+    esp_socketio_packet_handle_t packet = NULL;
+    xSemaphoreTake(client->tx_lock, portMAX_DELAY);
+    if (client->tx_queue_len > 0) {
+        packet = client->tx_queue[client->tx_queue_head];
+        client->tx_queue_head = (client->tx_queue_head + 1) % client->tx_queue_size;
+        client->tx_queue_len--;
+    }
+    xSemaphoreGive(client->tx_lock);
+    return packet;
+}
 
-                if ((SOCKETIO_STATE_OPENED == client->socketio_state || SOCKETIO_STATE_CONNECTED == client->socketio_state)) {
-                    if (EIO_PACKET_TYPE_MESSAGE == data->data_ptr[0]) {
-                        if (esp_socketio_packet_parse_message(client->rx_packet, data->data_ptr, data->data_len) != ESP_OK) {
-                            ESP_LOGE(TAG, "Error parsing message.");
-                            break;
-                        }
-                        char *nsp = esp_socketio_packet_get_nsp(client->rx_packet);
-                        esp_socketio_packet_type_t sio_type = esp_socketio_packet_get_sio_type(client->rx_packet);
-                        switch (sio_type)
-                        {
-                        case SIO_PACKET_TYPE_CONNECT:
-                            client->socketio_state = SOCKETIO_STATE_CONNECTED;
-                            cJSON *json_sid = cJSON_GetObjectItem(esp_socketio_packet_get_json(client->rx_packet), "sid");
-                            if (!(cJSON_IsString(json_sid) && json_sid->valuestring != NULL)) {
-                                ESP_LOGE(TAG, "Error! No Socket.IO data found in CONNECT message.");
-                                break;
-                            }
-                            ESP_LOGI(TAG, "Add namespace: %s, sid: %s", (nsp == NULL)? "/" : nsp, json_sid->valuestring);
-                            esp_socketio_ns_list_add_ns(client->ns_list, nsp, json_sid->valuestring);
-                            socketio_event_data.socketio_packet = client->rx_packet;
-                            esp_sio_client_dispatch_event(client, SOCKETIO_EVENT_NS_CONNECTED, &socketio_event_data, sizeof(esp_socketio_event_data_t));
-                            break;
-
-                        case SIO_PACKET_TYPE_DISCONNECT:
-                            if (esp_socketio_ns_list_delete_ns(client->ns_list, nsp) == ESP_ERR_NOT_FOUND) {
-                                ESP_LOGE(TAG, "Namespace not found");
-                            }
-                            if (esp_socketio_ns_list_get_num(client->ns_list) <= 0) {
-                                client->socketio_state = SOCKETIO_STATE_DISCONNECTED;
-                            }
-                            break;
-
-                        case SIO_PACKET_TYPE_EVENT:
-                        case SIO_PACKET_TYPE_ACK:
-                            socketio_event_data.socketio_packet = client->rx_packet;
-                            esp_sio_client_dispatch_event(client, SOCKETIO_EVENT_DATA, &socketio_event_data, sizeof(esp_socketio_event_data_t));
-                            break;
-
-                        case SIO_PACKET_TYPE_BINARY_EVENT:
-                        case SIO_PACKET_TYPE_BINARY_ACK:
-                            client->socketio_state = SOCKETIO_STATE_WAIT_FOR_BINARY;
-                            break;
-
-                        case SIO_PACKET_TYPE_CONNECT_ERROR:
-                            ESP_LOGE(TAG, "Received CONNECT_ERROR");
-                            break;
-
-                        default:
-                            break;
-                        }
-                    }
-                }
+static void esp_sio_client_tx_task(void *pv)
+{
+    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)pv;
 
-                if (EIO_PACKET_TYPE_PING == data->data_ptr[0] && data->data_len == 1) {
-                    ESP_LOGD(TAG, "Receive Engine.IO PING, sending PONG");
-                    esp_timer_stop(client->sio_ping_timer);
-                    char pong = EIO_PACKET_TYPE_PONG;
-                    esp_websocket_client_send_text(client->ws_client, &pong, 1, portMAX_DELAY);
-                    esp_timer_start_once(client->sio_ping_timer, (client->ping_interval + client->ping_timeout) * 1000);
-                }
+    while (true) {
+        xEventGroupWaitBits(client->tx_status, TX_READY_BIT | TX_STOP_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+        if (xEventGroupGetBits(client->tx_status) & TX_STOP_BIT) {
+            break;
+        }
+        // Cleared before draining, so a packet pushed meanwhile sets it again
+        EventBits_t bits = xEventGroupClearBits(client->tx_status, TX_READY_BIT | TX_OFFLINE_BIT);
+
+        esp_sio_client_flush_control(client, false);
+        if (bits & TX_OFFLINE_BIT) {
+            esp_sio_client_send_offline(client);
+        }
+        esp_socketio_packet_handle_t packet;
+        while ((packet = esp_sio_client_tx_pop(client)) != NULL) {
+            if (esp_sio_client_transmit(client, packet) != ESP_OK) {
+                ESP_LOGW(TAG, "Dropping queued packet");
             }
+            esp_sio_client_tx_release(client, packet);
+            esp_sio_client_flush_control(client, false);
+        }
+    }
+
+    xEventGroupSetBits(client->tx_status, TX_STOPPED_BIT);
+    vTaskDelete(NULL);
+}
+
+// The control lane is used with and without a TX queue
+static esp_err_t esp_sio_client_tx_lane_create(esp_socketio_client_handle_t client)
+{
+    client->tx_lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, client->tx_lock, return ESP_ERR_NO_MEM);
+    client->tx_status = xEventGroupCreate();
+    ESP_SOCKETIO_MEM_CHECK(TAG, client->tx_status, return ESP_ERR_NO_MEM);
+    return ESP_OK;
+}
+
+static esp_err_t esp_sio_client_tx_queue_create(esp_socketio_client_handle_t client, const esp_socketio_client_config_t *config)
+{
+    client->tx_queue_size = config->tx_queue_size;
+    client->tx_queue = calloc(client->tx_queue_size, sizeof(esp_socketio_packet_handle_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, client->tx_queue, return ESP_ERR_NO_MEM);
+    client->tx_free = calloc(client->tx_queue_size, sizeof(esp_socketio_packet_handle_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, client->tx_free, return ESP_ERR_NO_MEM);
+    for (size_t i = 0; i < client->tx_queue_size; i++) {
+        client->tx_free[i] = esp_socketio_packet_init();
+        ESP_SOCKETIO_MEM_CHECK(TAG, client->tx_free[i], return ESP_ERR_NO_MEM);
+        client->tx_free_num++;
+    }
+
+    if (xTaskCreate(esp_sio_client_tx_task, "sio_tx",
+                    (config->tx_task_stack > 0) ? config->tx_task_stack : CONFIG_ESP_SOCKETIO_TX_TASK_STACK_SIZE,
+                    client,
+                    (config->tx_task_prio > 0) ? config->tx_task_prio : CONFIG_ESP_SOCKETIO_TX_TASK_PRIORITY,
+                    &client->tx_task) != pdPASS) {
+        ESP_LOGE(TAG, "Error create Socket.IO TX task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Packets pushed once the TX task has stopped stay in the queue and are freed with it
+static void esp_sio_client_tx_queue_stop(esp_socketio_client_handle_t client)
+{
+    if (client->tx_task) {
+        xEventGroupSetBits(client->tx_status, TX_STOP_BIT);
+        xEventGroupWaitBits(client->tx_status, TX_STOPPED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+        client->tx_task = NULL;
+    }
+}
+
+static void esp_sio_client_tx_queue_destroy(esp_socketio_client_handle_t client)
+{
+    esp_sio_client_tx_queue_stop(client);
+
+    esp_socketio_packet_handle_t packet;
+    while (client->tx_lock != NULL && (packet = esp_sio_client_tx_pop(client)) != NULL) {
+        esp_socketio_packet_destroy(packet);
+    }
+    for (size_t i = 0; i < client->tx_free_num; i++) {
+        esp_socketio_packet_destroy(client->tx_free[i]);
+    }
+    for (size_t i = 0; i < client->tx_control_len; i++) {
+        free(client->tx_control[(client->tx_control_head + i) % client->tx_control_size].data);
+    }
+    free(client->tx_control);
+    free(client->tx_queue);
+    free(client->tx_free);
+    if (client->tx_lock) {
+        vSemaphoreDelete(client->tx_lock);
+    }
+    if (client->tx_status) {
+        vEventGroupDelete(client->tx_status);
+    }
+}
+
+static void esp_sio_client_dispatch_task(void *pv)
+{
+    esp_socketio_client_handle_t client = (esp_socketio_client_handle_t)pv;
+    esp_socketio_event_data_t socketio_event_data = {
+        .websocket_event_id = WEBSOCKET_EVENT_DATA,
+        .websocket_event = NULL,                            // Only valid on the receiving task
+        .socketio_packet = NULL,
+        .client = client,
+    };
 
-            if (client->socketio_state == SOCKETIO_STATE_WAIT_FOR_BINARY && data->op_code == WS_TRANSPORT_OPCODES_BINARY) {
-                ESP_LOGI(TAG, "Received binary");
-                esp_socketio_packet_add_binary_data(client->rx_packet, (const unsigned char *)data->data_ptr, data->data_len, false);
-                if (esp_socketio_packet_count_binary_data(client->rx_packet) == esp_socketio_packet_get_last_binary_index(client->rx_packet) + 1) {
-                    client->socketio_state = SOCKETIO_STATE_CONNECTED;
-                    socketio_event_data.socketio_packet = client->rx_packet;
-                    esp_sio_client_dispatch_event(client, SOCKETIO_EVENT_DATA, &socketio_event_data, sizeof(esp_socketio_event_data_t));
+    while (true) {
+        xEventGroupWaitBits(client->dispatch_status,
+                            DISPATCH_READY_BIT | DISPATCH_STOP_BIT | DISPATCH_PING_TIMEOUT_BIT | DISPATCH_OFFLINE_BIT,
+                            pdFALSE, pdFALSE, portMAX_DELAY);
+        if (xEventGroupGetBits(client->dispatch_status) & DISPATCH_STOP_BIT) {
+            break;
+        }
+        esp_sio_client_report_ping_timeout(client);
+        esp_sio_client_drain_deferred(client);
+        // Cleared before draining, so an event posted meanwhile sets it again
+        xEventGroupClearBits(client->dispatch_status, DISPATCH_READY_BIT);
+
+        esp_sio_dispatch_item_t item;
+        while (esp_socketio_ring_pop(client->dispatch_ring, &item)) {
+            socketio_event_data.socketio_packet = item.packet;
+            if (item.event == SOCKETIO_EVENT_DATA) {
+                esp_sio_client_deliver_data(client, item.packet, &socketio_event_data);
+            } else {
+                esp_sio_client_dispatch_event(client, item.event, &socketio_event_data, sizeof(esp_socketio_event_data_t));
+            }
+            if (item.packet != NULL && esp_socketio_packet_is_shared(item.packet)) {
+                // Retained by a handler: it goes back to packet_pool on its last release, the receiving task gets another one
+                esp_socketio_packet_release(item.packet);
+                item.packet = esp_socketio_packet_pool_get(client->packet_pool);
+                if (item.packet == NULL) {
+                    ESP_LOGE(TAG, "Error allocating a packet, the dispatch pool shrinks");
                 }
+            } else if (item.packet != NULL) {
+                // Reset here rather than by the next parse, so freeing the JSON tree stays off the receiving task
+                esp_socketio_packet_reset(item.packet);
+            }
+            if (item.packet != NULL) {
+                // The free ring has room for the whole pool, so pushing cannot fail
+                esp_socketio_ring_push(client->dispatch_free, &item.packet);
             }
+            xEventGroupSetBits(client->dispatch_status, DISPATCH_SPACE_BIT);
         }
+    }
 
-        break;
+    xEventGroupSetBits(client->dispatch_status, DISPATCH_STOPPED_BIT);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t esp_sio_client_dispatch_create(esp_socketio_client_handle_t client, const esp_socketio_client_config_t *config)
+{
+    client->dispatch_ring = esp_socketio_ring_create(config->dispatch_queue_size, sizeof(esp_sio_dispatch_item_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, client->dispatch_ring, return ESP_ERR_NO_MEM);
+    client->dispatch_free = esp_socketio_ring_create(config->dispatch_queue_size, sizeof(esp_socketio_packet_handle_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, client->dispatch_free, return ESP_ERR_NO_MEM);
+    // With rx_packet, one more packet than the ring holds: the receiving task parses while the ring is full
+    for (size_t i = 0; i < config->dispatch_queue_size; i++) {
+        esp_socketio_packet_handle_t packet = esp_socketio_packet_pool_get(client->packet_pool);
+        ESP_SOCKETIO_MEM_CHECK(TAG, packet, return ESP_ERR_NO_MEM);
+        esp_socketio_ring_push(client->dispatch_free, &packet);
+    }
+
+    if (xTaskCreatePinnedToCore(esp_sio_client_dispatch_task, "sio_dispatch",
+                                (config->dispatch_task_stack > 0) ? config->dispatch_task_stack : CONFIG_ESP_SOCKETIO_DISPATCH_TASK_STACK_SIZE,
+                                client,
+                                (config->dispatch_task_prio > 0) ? config->dispatch_task_prio : CONFIG_ESP_SOCKETIO_DISPATCH_TASK_PRIORITY,
+                                &client->dispatch_task,
+                                config->dispatch_task_pinned ? config->dispatch_task_core : tskNO_AFFINITY) != pdPASS) {
+        ESP_LOGE(TAG, "Error create Socket.IO dispatch task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// dispatch_task is kept, so events of the receiving task are still posted, and dropped, rather than
+// dispatched on that task
+static void esp_sio_client_dispatch_stop(esp_socketio_client_handle_t client)
+{
+    if (client->dispatch_task && !(xEventGroupGetBits(client->dispatch_status) & DISPATCH_STOPPED_BIT)) {
+        xEventGroupSetBits(client->dispatch_status, DISPATCH_STOP_BIT);
+        xEventGroupWaitBits(client->dispatch_status, DISPATCH_STOPPED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+}
+
+static void esp_sio_client_dispatch_destroy(esp_socketio_client_handle_t client)
+{
+    esp_sio_client_dispatch_stop(client);
+    client->dispatch_task = NULL;
+
+    // Both tasks are gone, so this task can consume both rings
+    esp_sio_dispatch_item_t item;
+    while (client->dispatch_ring != NULL && esp_socketio_ring_pop(client->dispatch_ring, &item)) {
+        esp_socketio_packet_release(item.packet);
+    }
+    esp_socketio_packet_handle_t packet;
+    while (client->dispatch_free != NULL && esp_socketio_ring_pop(client->dispatch_free, &packet)) {
+        esp_socketio_packet_release(packet);
+    }
+    esp_socketio_ring_destroy(client->dispatch_ring);
+    esp_socketio_ring_destroy(client->dispatch_free);
+    if (client->dispatch_status) {
+        vEventGroupDelete(client->dispatch_status);
     }
-    return;
 }
 
 static void esp_sio_client_destroy_and_free_client(esp_socketio_client_handle_t client)
@@ -217,14 +1858,37 @@ static void esp_sio_client_destroy_and_free_client(esp_socketio_client_handle_t
         return;
     }
 
+    // Handlers may still be running on the dispatch task when init fails
+    esp_sio_client_dispatch_destroy(client);
     if (client->event_handle) {
         esp_event_loop_delete(client->event_handle);
     }
 
+    esp_sio_client_tx_queue_destroy(client);
+    esp_socketio_offline_buffer_destroy(client->offline);
+    esp_socketio_outbox_destroy(client->outbox);
     esp_socketio_ns_list_destroy(client->ns_list);
+    esp_socketio_ack_table_destroy(client->ack_table);
 
-    esp_socketio_packet_destroy(client->rx_packet);
-    esp_socketio_packet_destroy(client->tx_packet);
+    esp_socketio_packet_release(client->rx_packet);
+    esp_socketio_packet_release(client->tx_packet);
+    // Packets retained or acquired by the application outlive the client, the pool is freed with the last of them
+    esp_socketio_packet_pool_destroy(client->packet_pool);
+    free(client->rx_buffer);
+    free(client->tx_chunk_buffer);
+    for (size_t i = 0; i < client->event_table_size; i++) {
+        esp_sio_event_entry_t *entry = client->event_table[i];
+        while (entry != NULL) {
+            esp_sio_event_entry_t *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(client->event_table);
+    if (client->event_lock) {
+        vSemaphoreDelete(client->event_lock);
+    }
+    esp_sio_client_free_sessions(client);
 
     free(client);
     return;
@@ -232,6 +1896,10 @@ static void esp_sio_client_destroy_and_free_client(esp_socketio_client_handle_t
 
 esp_socketio_client_handle_t esp_socketio_client_init(const esp_socketio_client_config_t *config)
 {
+#if CONFIG_ESP_SOCKETIO_JSON_ARENA
+    // Before the client tasks start parsing, cJSON reads its hooks without a lock
+    esp_socketio_json_arena_install_hooks();
+#endif
     esp_socketio_client_handle_t sio_client = calloc(1, sizeof(struct esp_socketio_client));
     if (!(sio_client)) {
         ESP_LOGE(TAG, "Error allocating socketio_client memory.");
@@ -249,20 +1917,104 @@ esp_socketio_client_handle_t esp_socketio_client_init(const esp_socketio_client_
         return NULL;
     });
 
-    sio_client->rx_packet = esp_socketio_packet_init();
-    sio_client->tx_packet = esp_socketio_packet_init();
+    sio_client->session_lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, sio_client->session_lock, {
+        esp_sio_client_destroy_and_free_client(sio_client);
+        return NULL;
+    });
+
+    sio_client->event_lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, sio_client->event_lock, {
+        esp_sio_client_destroy_and_free_client(sio_client);
+        return NULL;
+    });
+
+    sio_client->ack_table = esp_socketio_ack_table_create(sio_client,
+                            (config->ack_table_size > 0) ? config->ack_table_size : CONFIG_ESP_SOCKETIO_ACK_TABLE_SIZE,
+                            CONFIG_ESP_SOCKETIO_ACK_TICK_MS);
+    ESP_SOCKETIO_MEM_CHECK(TAG, sio_client->ack_table, {
+        esp_sio_client_destroy_and_free_client(sio_client);
+        return NULL;
+    });
+
+    sio_client->packet_pool = esp_socketio_packet_pool_create(CONFIG_ESP_SOCKETIO_PACKET_POOL_SIZE);
+    ESP_SOCKETIO_MEM_CHECK(TAG, sio_client->packet_pool, {
+        esp_sio_client_destroy_and_free_client(sio_client);
+        return NULL;
+    });
+    sio_client->rx_packet = esp_socketio_packet_pool_get(sio_client->packet_pool);
+    sio_client->tx_packet = esp_socketio_packet_pool_get(sio_client->packet_pool);
+    sio_client->rx_max_message_size = (config->rx_max_message_size > 0) ? config->rx_max_message_size : CONFIG_ESP_SOCKETIO_RX_MAX_MESSAGE_SIZE;
 
     esp_event_loop_args_t event_args = {
         .queue_size = SOCKETIO_EVENT_QUEUE_SIZE,
         .task_name = NULL // no task will be created
     };
 
-    if (esp_event_loop_create(&event_args, &sio_client->event_handle) != ESP_OK) {
+    sio_client->direct_dispatch = config->direct_dispatch;
+    if (!sio_client->direct_dispatch && esp_event_loop_create(&event_args, &sio_client->event_handle) != ESP_OK) {
         ESP_LOGE(TAG, "Error create event handler for websocket client");
         esp_sio_client_destroy_and_free_client(sio_client);
         return NULL;
     }
 
+    sio_client->chunked_transfer = config->chunked_transfer;
+    sio_client->reconnect_base_ms = (config->reconnect_base_ms > 0) ? config->reconnect_base_ms : CONFIG_ESP_SOCKETIO_RECONNECT_BASE_MS;
+    sio_client->reconnect_max_ms = (config->reconnect_max_ms > 0) ? config->reconnect_max_ms : CONFIG_ESP_SOCKETIO_RECONNECT_MAX_MS;
+
+    // Configured namespaces are the first sessions, encoded once here
+    for (size_t i = 0; i < config->namespace_count; i++) {
+        const char *nsp = (config->namespaces[i].nsp != NULL) ? config->namespaces[i].nsp : "/";
+        char *frame = NULL;
+        size_t len = 0;
+        esp_err_t err = (strlen(nsp) > ESP_SOCKETIO_NSP_MAX_LEN) ? ESP_ERR_INVALID_SIZE
+                        : esp_sio_client_encode_connect_alloc(nsp, config->namespaces[i].auth, &frame, &len);
+        if (err == ESP_OK) {
+            err = esp_sio_client_add_session(sio_client, nsp, config->namespaces[i].auth, frame, len, true);
+        }
+        free(frame);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error adding namespace \"%s\": %s", nsp, esp_err_to_name(err));
+            esp_sio_client_destroy_and_free_client(sio_client);
+            return NULL;
+        }
+    }
+    sio_client->configured_num = sio_client->session_num;
+
+    if (config->outbox_path != NULL) {
+        sio_client->outbox = esp_socketio_outbox_create(config->outbox_path,
+                             (config->outbox_segment_size > 0) ? config->outbox_segment_size : CONFIG_ESP_SOCKETIO_OUTBOX_SEGMENT_SIZE,
+                             (config->outbox_max_segments > 0) ? config->outbox_max_segments : CONFIG_ESP_SOCKETIO_OUTBOX_MAX_SEGMENTS,
+                             config->offline_policy);
+        ESP_SOCKETIO_MEM_CHECK(TAG, sio_client->outbox, {
+            esp_sio_client_destroy_and_free_client(sio_client);
+            return NULL;
+        });
+    } else if (config->offline_buffer_size > 0) {
+        sio_client->offline = esp_socketio_offline_buffer_create(config->offline_buffer_size, config->offline_policy);
+        ESP_SOCKETIO_MEM_CHECK(TAG, sio_client->offline, {
+            esp_sio_client_destroy_and_free_client(sio_client);
+            return NULL;
+        });
+    }
+
+    if (esp_sio_client_tx_lane_create(sio_client) != ESP_OK
+        || (config->tx_queue_size > 0 && esp_sio_client_tx_queue_create(sio_client, config) != ESP_OK)) {
+        esp_sio_client_destroy_and_free_client(sio_client);
+        return NULL;
+    }
+
+    sio_client->dispatch_status = xEventGroupCreate();
+    ESP_SOCKETIO_MEM_CHECK(TAG, sio_client->dispatch_status, {
+        esp_sio_client_destroy_and_free_client(sio_client);
+        return NULL;
+    });
+
+    if (config->dispatch_queue_size > 0 && esp_sio_client_dispatch_create(sio_client, config) != ESP_OK) {
+        esp_sio_client_destroy_and_free_client(sio_client);
+        return NULL;
+    }
+
     esp_websocket_register_events(sio_client->ws_client, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void *)sio_client);
 
     const esp_timer_create_args_t oneshot_timer_args = {
@@ -291,78 +2043,167 @@ esp_err_t esp_socketio_client_connect_nsp(esp_socketio_client_handle_t client, c
         return ESP_ERR_INVALID_STATE;
     }
 
+    // Joined namespaces are connected again on OPEN, before SOCKETIO_EVENT_OPENED: a second CONNECT
+    // would open a second socket on the server, which would deliver each event twice
+    xSemaphoreTake(client->session_lock, portMAX_DELAY);
+    esp_sio_session_t *session = esp_sio_client_find_session(client, nsp);
+    bool pending = session != NULL && session->joined && session->connecting;
+    xSemaphoreGive(client->session_lock);
+    if (pending) {
+        ESP_LOGI(TAG, "Namespace \"%s\" already being connected.", (nsp == NULL) ? "/" : nsp);
+        return ESP_OK;
+    }
+
     if (esp_socketio_ns_list_is_nsp_exist(client->ns_list, nsp)) {
         ESP_LOGE(TAG, "Namespace \"%s\" already connected.", nsp);
         return ESP_ERR_INVALID_ARG;
     }
 
-    char *sio_connect = NULL;
-    int len = (nsp == NULL) ? 2 : 3 + strlen(nsp);
-    char *json_string = cJSON_PrintUnformatted(data);
-    if (json_string != NULL) {
-        len += strlen(json_string);
-    }
-    sio_connect = calloc(1, len);
-    if (sio_connect == NULL) {
-        ESP_LOGE(TAG, "Error allocating sio_connect memory.");
-        return ESP_ERR_NO_MEM;
+    esp_socketio_packet_header_t header = {
+        .eio_type = EIO_PACKET_TYPE_MESSAGE,
+        .sio_type = SIO_PACKET_TYPE_CONNECT,
+        .nsp = nsp,
+        .nsp_len = (nsp == NULL) ? 0 : strlen(nsp),
+        .event_id = -1,
+    };
+
+    // Encode on the stack; only an unusually large CONNECT payload needs the heap
+    char stack_buffer[SOCKETIO_CONNECT_BUFFER_SIZE];
+    char *sio_connect = stack_buffer;
+    size_t buffer_size = sizeof(stack_buffer);
+    size_t len = 0;
+    while ((ret = esp_sio_client_encode_connect(&header, data, sio_connect, buffer_size, &len)) == ESP_ERR_INVALID_SIZE) {
+        if (sio_connect != stack_buffer) {
+            free(sio_connect);
+        }
+        buffer_size *= 2;
+        sio_connect = malloc(buffer_size);
+        if (sio_connect == NULL) {
+            ESP_LOGE(TAG, "Error allocating sio_connect memory.");
+            return ESP_ERR_NO_MEM;
+        }
     }
-    sio_connect[0] = EIO_PACKET_TYPE_MESSAGE;
-    sio_connect[1] = SIO_PACKET_TYPE_CONNECT;
-    char *ptr = &sio_connect[2];
-    if (nsp != NULL) {
-        ptr += sprintf(&sio_connect[2], "%s,", nsp);
+
+    if (ret == ESP_OK) {
+        ret = esp_sio_client_add_session(client, nsp, data, sio_connect, len, false);
     }
-    if (json_string != NULL) {
-        sprintf(ptr, "%s", json_string);
-        free(json_string);
+
+    if (ret == ESP_OK) {
+        // Marked before sending, so the answer cannot arrive before it
+        esp_sio_client_set_connecting(client, nsp, true);
+        ret = esp_sio_client_send_control(client, sio_connect, len, 0);
+        if (ret == ESP_OK) {
+            ESP_LOGI(TAG, "Send connect (size: %d) to \"%s\" successfully.", (int)len, (nsp == NULL) ? "/" : nsp);
+        } else {
+            ESP_LOGE(TAG, "Send connect failed.");
+            esp_sio_client_set_connecting(client, nsp, false);
+        }
     }
-    int send_len = esp_websocket_client_send_text(client->ws_client, sio_connect, len, portMAX_DELAY);
-    if (send_len > 0) {
-        ESP_LOGI(TAG, "Send connect (size: %d) to \"%s\" successfully.", send_len, (nsp == NULL) ? "/" : nsp);
-        ret = ESP_OK;
-    } else {
-        ESP_LOGE(TAG, "Send connect failed.");
-        ret = ESP_FAIL;
+
+    if (sio_connect != stack_buffer) {
+        free(sio_connect);
     }
-    free(sio_connect);
     return ret;
 }
 
 esp_err_t esp_socketio_client_send_data(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet)
 {
-    esp_err_t ret = ESP_OK;
-    if (!esp_websocket_client_is_connected(client->ws_client)) {
-        return ESP_ERR_INVALID_STATE;
-    }
+    return esp_socketio_client_send_data_with_flags(client, packet, 0);
+}
 
+esp_err_t esp_socketio_client_send_data_with_flags(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet, int flags)
+{
     const char *nsp = esp_socketio_packet_get_nsp(packet);
-    if (!esp_socketio_ns_list_is_nsp_exist(client->ns_list, nsp)) {
+    bool ws_connected = esp_websocket_client_is_connected(client->ws_client);
+    bool connected = ws_connected && esp_socketio_ns_list_is_nsp_exist(client->ns_list, nsp);
+    esp_socketio_packet_type_t sio_type = esp_socketio_packet_get_sio_type(packet);
+    // The journal only takes events, which it sends with ack ids of its own
+    bool journaled = client->outbox != NULL
+                     && (sio_type == SIO_PACKET_TYPE_EVENT || sio_type == SIO_PACKET_TYPE_BINARY_EVENT);
+    // Kept for a namespace that is connected again on the next OPEN, or behind journaled packets
+    if ((client->offline != NULL || journaled) && !(flags & ESP_SOCKETIO_SEND_VOLATILE)
+        && (!connected || !esp_socketio_outbox_is_empty(client->outbox))
+        && esp_sio_client_is_joined(client, nsp)) {
+        if (journaled && esp_socketio_packet_get_event_id(packet) >= 0) {
+            // The journal would replace its ack id, so its callback could only time out
+            ESP_LOGE(TAG, "Cannot journal a packet requesting an acknowledgement.");
+            return ESP_ERR_INVALID_STATE;
+        }
+        return esp_sio_client_store_offline(client, packet);
+    }
+    if (!connected) {
+        if (!ws_connected) {
+            if (flags & ESP_SOCKETIO_SEND_VOLATILE) {
+                esp_socketio_packet_reset(packet);
+                return ESP_OK;
+            }
+            return ESP_ERR_INVALID_STATE;
+        }
         ESP_LOGE(TAG, "Namespace \"%s\" not connected.", nsp);
         return ESP_ERR_INVALID_ARG;
     }
 
-    esp_socketio_packet_encode_message(packet);
-    int data_len = 0;
-    char *data = esp_socketio_packet_get_raw_data(packet, &data_len);
-    esp_websocket_client_send_text(client->ws_client, data, data_len, portMAX_DELAY);
-    int binary_count = esp_socketio_packet_count_binary_data(packet);
-    unsigned char *current_binary = NULL;
-    size_t binary_size = 0;
-    int binary_index = 0;
-    while (binary_count--) {
-        ret = esp_socketio_packet_get_current_binary_data(packet, &current_binary, &binary_size, &binary_index);
-        if (ret == ESP_OK) {
-            esp_websocket_client_send_bin(client->ws_client, (const char *)current_binary, (int)binary_size, portMAX_DELAY);
+    if (client->tx_queue == NULL) {
+        return esp_sio_client_transmit(client, packet);
+    }
+
+    // The text frame is only encoded by the TX task, which drops it if it is too large
+    bool chunked = false;
+    esp_err_t ret = esp_sio_client_check_attachments(client, packet, &chunked);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if ((flags & ESP_SOCKETIO_SEND_COALESCE) && esp_sio_client_tx_coalesce(client, packet)) {
+        // `packet` now holds the stale contents
+        esp_socketio_packet_reset(packet);
+        return ESP_OK;
+    }
+
+    esp_socketio_packet_handle_t queued = esp_sio_client_tx_acquire(client);
+    if (queued == NULL) {
+        if (flags & ESP_SOCKETIO_SEND_VOLATILE) {
+            esp_socketio_packet_reset(packet);
+            return ESP_OK;
         }
+        return ESP_ERR_TIMEOUT;
     }
+    esp_socketio_packet_swap(queued, packet);
+    esp_sio_client_tx_push(client, queued);
     return ESP_OK;
 }
 
+esp_err_t esp_socketio_client_send_data_with_ack(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet,
+        uint32_t timeout_ms, esp_socketio_ack_cb_t cb, void *arg)
+{
+    if (client == NULL || packet == NULL || cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Registered before sending, the ACK may arrive before esp_socketio_client_send_data returns
+    int id = -1;
+    esp_err_t ret = esp_socketio_ack_table_add(client->ack_table, timeout_ms, cb, arg, &id);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    esp_socketio_packet_set_event_id(packet, id);
+
+    ret = esp_socketio_client_send_data(client, packet);
+    if (ret != ESP_OK) {
+        esp_socketio_ack_table_cancel(client->ack_table, id);
+    }
+    return ret;
+}
+
 esp_err_t esp_socketio_client_close(esp_socketio_client_handle_t client, TickType_t timeout)
 {
     char close_packet = EIO_PACKET_TYPE_CLOSE;
-    esp_websocket_client_send_text(client->ws_client, &close_packet, 1, timeout);
+    client->socketio_state = SOCKETIO_STATE_CLOSED;
+    if (client->tx_queue == NULL) {
+        esp_websocket_client_send_text(client->ws_client, &close_packet, 1, timeout);
+    } else if (esp_sio_client_send_control(client, &close_packet, 1, 0) == ESP_OK) {
+        xEventGroupWaitBits(client->tx_status, TX_CONTROL_SENT_BIT, pdFALSE, pdTRUE, timeout);
+    }
     esp_websocket_client_close(client->ws_client, portMAX_DELAY);
     return ESP_OK;
 }
@@ -370,6 +2211,12 @@ esp_err_t esp_socketio_client_close(esp_socketio_client_handle_t client, TickTyp
 esp_err_t esp_socketio_client_destroy(esp_socketio_client_handle_t client)
 {
     ESP_LOGI(TAG, "%s called", __FUNCTION__);
+    // Everything sending on ws_client is stopped before it is destroyed. The receiving task runs until
+    // then, so the timers are stopped again before being deleted.
+    esp_timer_stop(client->sio_ping_timer);
+    esp_socketio_ack_table_stop(client->ack_table);
+    esp_sio_client_dispatch_stop(client);
+    esp_sio_client_tx_queue_stop(client);
     esp_websocket_client_destroy(client->ws_client);
     client->ws_client = NULL;
     esp_timer_stop(client->sio_ping_timer);
@@ -378,6 +2225,14 @@ esp_err_t esp_socketio_client_destroy(esp_socketio_client_handle_t client)
     return ESP_OK;
 }
 
+esp_socketio_packet_handle_t esp_socketio_client_acquire_packet(esp_socketio_client_handle_t client)
+{
+    if (client == NULL) {
+        return NULL;
+    }
+    return esp_socketio_packet_pool_get(client->packet_pool);
+}
+
 esp_socketio_packet_handle_t esp_socketio_client_get_tx_packet(esp_socketio_client_handle_t client)
 {
     if (client == NULL) {
@@ -394,6 +2249,102 @@ int esp_socketio_client_get_max_payload(esp_socketio_client_handle_t client)
     return client->max_payload;
 }
 
+esp_err_t esp_socketio_client_get_heartbeat_stats(esp_socketio_client_handle_t client, esp_socketio_heartbeat_stats_t *stats)
+{
+    if (client == NULL || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = client->heartbeat;
+    return ESP_OK;
+}
+
+bool esp_socketio_client_is_recovered(esp_socketio_client_handle_t client, const char *nsp)
+{
+    if (client == NULL) {
+        return false;
+    }
+    const esp_sio_session_t *session = esp_socketio_ns_list_get_data(client->ns_list, nsp);
+    return session != NULL && session->recovered;
+}
+
+esp_err_t esp_socketio_client_on(esp_socketio_client_handle_t client, const char *nsp, const char *event_name,
+        esp_socketio_event_handler_t handler, void *arg)
+{
+    if (client == NULL || event_name == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (nsp == NULL) {
+        nsp = "/";
+    }
+    if (strlen(nsp) > ESP_SOCKETIO_NSP_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(client->event_lock, portMAX_DELAY);
+    esp_sio_event_entry_t *entry;
+    if (handler == NULL) {
+        entry = esp_sio_client_find_event(client, nsp, event_name);
+        if (entry == NULL || entry->handler == NULL) {
+            ret = ESP_ERR_NOT_FOUND;
+        } else {
+            entry->handler = NULL;
+            if (entry->sink == NULL) {
+                esp_sio_client_remove_event(client, entry);
+            }
+        }
+    } else if ((entry = esp_sio_client_add_event(client, nsp, event_name)) == NULL) {
+        ret = ESP_ERR_NO_MEM;
+    } else {
+        entry->handler = handler;
+        entry->handler_arg = arg;
+    }
+    xSemaphoreGive(client->event_lock);
+    return ret;
+}
+
+esp_err_t esp_socketio_client_register_binary_sink(esp_socketio_client_handle_t client, const char *nsp, const char *event_name,
+        esp_socketio_binary_sink_cb_t sink, void *arg)
+{
+    if (client == NULL || event_name == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (nsp == NULL) {
+        nsp = "/";
+    }
+    if (strlen(nsp) > ESP_SOCKETIO_NSP_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(client->event_lock, portMAX_DELAY);
+    esp_sio_event_entry_t *entry;
+    if (sink == NULL) {
+        entry = esp_sio_client_find_event(client, nsp, event_name);
+        if (entry == NULL || entry->sink == NULL) {
+            ret = ESP_ERR_NOT_FOUND;
+        } else {
+            // An event streaming to it is dropped by the receiving task
+            entry->sink = NULL;
+            entry->sink_id = 0;
+            if (entry->handler == NULL) {
+                esp_sio_client_remove_event(client, entry);
+            }
+        }
+    } else if ((entry = esp_sio_client_add_event(client, nsp, event_name)) == NULL) {
+        ret = ESP_ERR_NO_MEM;
+    } else {
+        entry->sink = sink;
+        entry->sink_arg = arg;
+        if (++client->next_sink_id == 0) {
+            client->next_sink_id = 1;
+        }
+        entry->sink_id = client->next_sink_id;
+    }
+    xSemaphoreGive(client->event_lock);
+    return ret;
+}
+
 esp_err_t esp_socketio_register_events(esp_socketio_client_handle_t client,
                                         esp_socketio_event_id_t event,
                                         esp_event_handler_t event_handler,
@@ -402,5 +2353,22 @@ esp_err_t esp_socketio_register_events(esp_socketio_client_handle_t client,
     if (client == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
+    if (client->direct_dispatch) {
+        if (event < SOCKETIO_EVENT_ANY || event >= SOCKETIO_EVENT_MAX || event_handler == NULL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        esp_err_t ret = ESP_OK;
+        xSemaphoreTake(client->event_lock, portMAX_DELAY);
+        esp_sio_direct_handler_t *handler = &client->direct_handlers[event + 1];
+        if (handler->handler != NULL) {
+            ESP_LOGE(TAG, "A handler is already registered for event %d", event);
+            ret = ESP_ERR_INVALID_STATE;
+        } else {
+            handler->handler = event_handler;
+            handler->arg = event_handler_arg;
+        }
+        xSemaphoreGive(client->event_lock);
+        return ret;
+    }
     return esp_event_handler_register_with(client->event_handle, SOCKETIO_EVENTS, event, event_handler, event_handler_arg);
 }
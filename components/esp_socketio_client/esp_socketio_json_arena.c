@@ -0,0 +1,149 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <cJSON.h>
+#include "esp_socketio_json_arena.h"
+#include "esp_socketio_internal.h"
+
+static const char *TAG = "socketio_json_arena";
+
+// cJSON nodes hold a double
+#define ARENA_ALIGN                     (8)
+#define ARENA_ALIGN_UP(addr)            (((addr) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1))
+
+typedef struct esp_socketio_json_chunk {
+    struct esp_socketio_json_chunk  *next;
+    size_t                          size;
+    uint8_t                         data[];
+} esp_socketio_json_chunk_t;
+
+struct esp_socketio_json_arena {
+    esp_socketio_json_chunk_t       *head;
+    esp_socketio_json_chunk_t       *current;           // Chunk being filled, the ones after it are free
+    size_t                          offset;             // Bytes used in `current`
+    size_t                          chunk_size;
+};
+
+// Arena of the calling task, NULL when cJSON uses the heap
+static __thread esp_socketio_json_arena_handle_t s_current_arena;
+static atomic_bool s_hooks_installed;
+
+static void *arena_malloc(size_t size);
+static void arena_free(void *ptr);
+static void *arena_alloc(esp_socketio_json_arena_handle_t arena, size_t size);
+
+esp_socketio_json_arena_handle_t esp_socketio_json_arena_create(size_t chunk_size)
+{
+    esp_socketio_json_arena_handle_t arena = calloc(1, sizeof(struct esp_socketio_json_arena));
+    ESP_SOCKETIO_MEM_CHECK(TAG, arena, return NULL);
+    arena->chunk_size = chunk_size;
+    return arena;
+}
+
+void esp_socketio_json_arena_install_hooks(void)
+{
+    if (atomic_load(&s_hooks_installed)) {
+        return;
+    }
+    cJSON_Hooks hooks = {
+        .malloc_fn = arena_malloc,
+        .free_fn = arena_free,
+    };
+    cJSON_InitHooks(&hooks);
+    // Only published once cJSON calls the hooks, so no tree is parsed half on the heap
+    atomic_store(&s_hooks_installed, true);
+}
+
+bool esp_socketio_json_arena_begin(esp_socketio_json_arena_handle_t arena)
+{
+    if (!atomic_load(&s_hooks_installed)) {
+        return false;
+    }
+    s_current_arena = arena;
+    return true;
+}
+
+void esp_socketio_json_arena_end(void)
+{
+    s_current_arena = NULL;
+}
+
+void esp_socketio_json_arena_reset(esp_socketio_json_arena_handle_t arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+    arena->current = arena->head;
+    arena->offset = 0;
+}
+
+void esp_socketio_json_arena_destroy(esp_socketio_json_arena_handle_t arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+    esp_socketio_json_chunk_t *chunk = arena->head;
+    while (chunk != NULL) {
+        esp_socketio_json_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void *arena_malloc(size_t size)
+{
+    if (s_current_arena != NULL) {
+        return arena_alloc(s_current_arena, size);
+    }
+    return malloc(size);
+}
+
+void arena_free(void *ptr)
+{
+    // While an arena is set, cJSON only frees what it has just allocated from it, on parse errors
+    if (s_current_arena == NULL) {
+        free(ptr);
+    }
+}
+
+void *arena_alloc(esp_socketio_json_arena_handle_t arena, size_t size)
+{
+    for (;;) {
+        esp_socketio_json_chunk_t *chunk = arena->current;
+        if (chunk != NULL) {
+            uintptr_t start = ARENA_ALIGN_UP((uintptr_t)chunk->data + arena->offset);
+            if (start + size <= (uintptr_t)chunk->data + chunk->size) {
+                arena->offset = start + size - (uintptr_t)chunk->data;
+                return (void *)start;
+            }
+            if (chunk->next != NULL) {
+                // Kept from before the last reset
+                arena->current = chunk->next;
+                arena->offset = 0;
+                continue;
+            }
+        }
+
+        size_t chunk_size = (size + ARENA_ALIGN > arena->chunk_size) ? size + ARENA_ALIGN : arena->chunk_size;
+        esp_socketio_json_chunk_t *new_chunk = malloc(sizeof(esp_socketio_json_chunk_t) + chunk_size);
+        ESP_SOCKETIO_MEM_CHECK(TAG, new_chunk, return NULL);
+        new_chunk->next = NULL;
+        new_chunk->size = chunk_size;
+        if (chunk == NULL) {
+            arena->head = new_chunk;
+        } else {
+            chunk->next = new_chunk;
+        }
+        arena->current = new_chunk;
+        arena->offset = 0;
+    }
+}
@@ -6,118 +6,198 @@
 
 #include <stdio.h>
 #include "esp_socketio_ns_list.h"
+#include "esp_socketio_packet.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_socketio_internal.h"
 
 static const char *TAG = "socketio_ns_list";
+static const char *default_nsp = "/";
+
+#define SOCKETIO_NS_TABLE_MIN_SIZE  (8)
 
 typedef struct esp_socketio_ns {
-    char *nsp;
-    char *sid;
-    struct esp_socketio_ns *next;
+    uint32_t    hash;
+    bool        used;
+    char        nsp[ESP_SOCKETIO_NSP_MAX_LEN + 1];  // Interned name, "/" for the default namespace
+    char        *sid;
+    void        *data;
 } esp_socketio_ns_t;
 
 struct esp_socketio_ns_list {
-    esp_socketio_ns_t   *namespaces;
+    esp_socketio_ns_t   *slots;                 // Open addressing with linear probing, at most half full
+    size_t              size;                   // Number of slots, a power of 2
     int                 num_namespaces;
+    SemaphoreHandle_t   lock;                   // Namespaces are added by the receiving task while the application looks them up
 };
 
+static const char *normalize_nsp(const char *nsp);
+static uint32_t hash_nsp(const char *nsp);
+static int find_slot(esp_socketio_ns_list_handle_t ns_list, const char *nsp, uint32_t hash);
+static esp_err_t grow_table(esp_socketio_ns_list_handle_t ns_list);
+static void clear_slots(esp_socketio_ns_list_handle_t ns_list);
+
 esp_socketio_ns_list_handle_t esp_socketio_ns_list_create()
 {
     esp_socketio_ns_list_handle_t ns_list = calloc(1, sizeof(struct esp_socketio_ns_list));
     ESP_SOCKETIO_MEM_CHECK(TAG, ns_list, return NULL);
+    ns_list->slots = calloc(SOCKETIO_NS_TABLE_MIN_SIZE, sizeof(esp_socketio_ns_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, ns_list->slots, {
+        free(ns_list);
+        return NULL;
+    });
+    ns_list->size = SOCKETIO_NS_TABLE_MIN_SIZE;
+    ns_list->lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, ns_list->lock, {
+        free(ns_list->slots);
+        free(ns_list);
+        return NULL;
+    });
     return ns_list;
 }
 
-esp_err_t esp_socketio_ns_list_add_ns(esp_socketio_ns_list_handle_t ns_list, char *nsp, char *sid)
+esp_err_t esp_socketio_ns_list_add_ns(esp_socketio_ns_list_handle_t ns_list, const char *nsp, const char *sid)
 {
     ESP_SOCKETIO_MEM_CHECK(TAG, (ns_list != NULL && sid != NULL), return ESP_ERR_INVALID_ARG);
 
-    esp_socketio_ns_t *new_namespace = calloc(1, sizeof(esp_socketio_ns_t));
-    // NULL represents default namespace
-    if (nsp != NULL) {
-        new_namespace->nsp = strdup(nsp);
-        ESP_SOCKETIO_MEM_CHECK(TAG, new_namespace->nsp, return ESP_ERR_NO_MEM);
+    nsp = normalize_nsp(nsp);
+    if (strlen(nsp) > ESP_SOCKETIO_NSP_MAX_LEN) {
+        return ESP_ERR_INVALID_SIZE;
     }
-    new_namespace->sid = strdup(sid);
-    ESP_SOCKETIO_MEM_CHECK(TAG, new_namespace->sid, return ESP_ERR_NO_MEM);
-    new_namespace->next = NULL;
-
-    if (ns_list->namespaces == NULL) {
-        ns_list->namespaces = new_namespace;
-    } else {
-        esp_socketio_ns_t *current = ns_list->namespaces;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = new_namespace;
+
+    char *new_sid = strdup(sid);
+    ESP_SOCKETIO_MEM_CHECK(TAG, new_sid, return ESP_ERR_NO_MEM);
+
+    uint32_t hash = hash_nsp(nsp);
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    int index = find_slot(ns_list, nsp, hash);
+    if (index >= 0) {
+        // Connected again, e.g. after a reconnection: only the session changes
+        free(ns_list->slots[index].sid);
+        ns_list->slots[index].sid = new_sid;
+        xSemaphoreGive(ns_list->lock);
+        return ESP_OK;
+    }
+
+    if ((size_t)(ns_list->num_namespaces + 1) * 2 > ns_list->size && grow_table(ns_list) != ESP_OK) {
+        xSemaphoreGive(ns_list->lock);
+        free(new_sid);
+        return ESP_ERR_NO_MEM;
     }
+
+    size_t mask = ns_list->size - 1;
+    size_t slot = hash & mask;
+    while (ns_list->slots[slot].used) {
+        slot = (slot + 1) & mask;
+    }
+    esp_socketio_ns_t *entry = &ns_list->slots[slot];
+    entry->hash = hash;
+    entry->used = true;
+    strcpy(entry->nsp, nsp);
+    entry->sid = new_sid;
     ns_list->num_namespaces++;
+    xSemaphoreGive(ns_list->lock);
     return ESP_OK;
 }
 
-char *esp_socketio_ns_list_search_sid(esp_socketio_ns_list_handle_t ns_list, char *nsp)
+char *esp_socketio_ns_list_search_sid(esp_socketio_ns_list_handle_t ns_list, const char *nsp)
 {
     ESP_SOCKETIO_MEM_CHECK(TAG, ns_list, return NULL);
 
-    esp_socketio_ns_t *current = ns_list->namespaces;
-    while (current != NULL) {
-        if ((nsp == NULL && current->nsp == NULL) ||
-            (nsp != NULL && current->nsp != NULL && strcmp(current->nsp, nsp) == 0)) {
-            return current->sid;
-        }
-        current = current->next;
-    }
-    return NULL;
+    nsp = normalize_nsp(nsp);
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    int index = find_slot(ns_list, nsp, hash_nsp(nsp));
+    char *sid = (index >= 0) ? ns_list->slots[index].sid : NULL;
+    xSemaphoreGive(ns_list->lock);
+    return sid;
 }
 
 bool esp_socketio_ns_list_is_nsp_exist(esp_socketio_ns_list_handle_t ns_list, const char *nsp)
 {
     ESP_SOCKETIO_MEM_CHECK(TAG, ns_list, return false);
 
-    esp_socketio_ns_t *current = ns_list->namespaces;
-    while (current != NULL) {
-        if ((nsp == NULL && current->nsp == NULL) ||
-            (nsp != NULL && current->nsp != NULL && strcmp(current->nsp, nsp) == 0)) {
-            return true;
-        }
-        current = current->next;
+    nsp = normalize_nsp(nsp);
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    bool exist = find_slot(ns_list, nsp, hash_nsp(nsp)) >= 0;
+    xSemaphoreGive(ns_list->lock);
+    return exist;
+}
+
+esp_err_t esp_socketio_ns_list_set_data(esp_socketio_ns_list_handle_t ns_list, const char *nsp, void *data)
+{
+    ESP_SOCKETIO_MEM_CHECK(TAG, ns_list, return ESP_ERR_INVALID_ARG);
+
+    nsp = normalize_nsp(nsp);
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    int index = find_slot(ns_list, nsp, hash_nsp(nsp));
+    if (index >= 0) {
+        ns_list->slots[index].data = data;
     }
-    return false;
+    xSemaphoreGive(ns_list->lock);
+    return (index >= 0) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void *esp_socketio_ns_list_get_data(esp_socketio_ns_list_handle_t ns_list, const char *nsp)
+{
+    ESP_SOCKETIO_MEM_CHECK(TAG, ns_list, return NULL);
+
+    nsp = normalize_nsp(nsp);
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    int index = find_slot(ns_list, nsp, hash_nsp(nsp));
+    void *data = (index >= 0) ? ns_list->slots[index].data : NULL;
+    xSemaphoreGive(ns_list->lock);
+    return data;
 }
 
 int esp_socketio_ns_list_get_num(esp_socketio_ns_list_handle_t ns_list)
 {
     ESP_SOCKETIO_MEM_CHECK(TAG, ns_list, return -1);
-    return ns_list->num_namespaces;
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    int num = ns_list->num_namespaces;
+    xSemaphoreGive(ns_list->lock);
+    return num;
 }
 
-esp_err_t esp_socketio_ns_list_delete_ns(esp_socketio_ns_list_handle_t ns_list, char *nsp)
+esp_err_t esp_socketio_ns_list_delete_ns(esp_socketio_ns_list_handle_t ns_list, const char *nsp)
 {
-    esp_socketio_ns_t *current = ns_list->namespaces;
-    esp_socketio_ns_t *prev = NULL;
-
-    while (current != NULL) {
-        if ((nsp == NULL && current->nsp == NULL) ||
-            (nsp != NULL && current->nsp != NULL && strcmp(current->nsp, nsp) == 0)) {
-            if (prev == NULL) {
-                ns_list->namespaces = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            if (current->nsp != NULL) {
-                free(current->nsp);
-            }
-            if (current->sid != NULL) {
-                free(current->sid);
-            }
-            free(current);
-            ns_list->num_namespaces--;
-            return ESP_OK;
+    ESP_SOCKETIO_MEM_CHECK(TAG, ns_list, return ESP_ERR_INVALID_ARG);
+
+    nsp = normalize_nsp(nsp);
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    int index = find_slot(ns_list, nsp, hash_nsp(nsp));
+    if (index < 0) {
+        xSemaphoreGive(ns_list->lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    free(ns_list->slots[index].sid);
+    ns_list->num_namespaces--;
+
+    // Shift the following entries of the probe sequence back, so lookups never need tombstones
+    size_t mask = ns_list->size - 1;
+    size_t hole = index;
+    size_t slot = (hole + 1) & mask;
+    while (ns_list->slots[slot].used) {
+        size_t home = ns_list->slots[slot].hash & mask;
+        // Move the entry unless its home lies cyclically in (hole, slot]
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            ns_list->slots[hole] = ns_list->slots[slot];
+            hole = slot;
         }
-        prev = current;
-        current = current->next;
+        slot = (slot + 1) & mask;
     }
-    return ESP_ERR_NOT_FOUND;
+    memset(&ns_list->slots[hole], 0, sizeof(esp_socketio_ns_t));
+    xSemaphoreGive(ns_list->lock);
+    return ESP_OK;
+}
+
+void esp_socketio_ns_list_clear(esp_socketio_ns_list_handle_t ns_list)
+{
+    if (ns_list == NULL) {
+        return;
+    }
+    xSemaphoreTake(ns_list->lock, portMAX_DELAY);
+    clear_slots(ns_list);
+    xSemaphoreGive(ns_list->lock);
 }
 
 void esp_socketio_ns_list_destroy(esp_socketio_ns_list_handle_t ns_list)
@@ -125,19 +205,69 @@ void esp_socketio_ns_list_destroy(esp_socketio_ns_list_handle_t ns_list)
     if (ns_list == NULL) {
         return;
     }
-    esp_socketio_ns_t *current = ns_list->namespaces;
-    esp_socketio_ns_t *temp = NULL;
-    while (current != NULL) {
-        temp = current;
-        current = current->next;
-        if (temp->nsp != NULL) {
-            free(temp->nsp);
+    clear_slots(ns_list);
+    vSemaphoreDelete(ns_list->lock);
+    free(ns_list->slots);
+    free(ns_list);
+    return;
+}
+
+const char *normalize_nsp(const char *nsp)
+{
+    // NULL, "" and "/" all name the default namespace
+    return (nsp == NULL || nsp[0] == '\0') ? default_nsp : nsp;
+}
+
+uint32_t hash_nsp(const char *nsp)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *pos = nsp; *pos != '\0'; pos++) {
+        hash = (hash ^ (uint8_t)*pos) * 16777619u;
+    }
+    return hash;
+}
+
+int find_slot(esp_socketio_ns_list_handle_t ns_list, const char *nsp, uint32_t hash)
+{
+    size_t mask = ns_list->size - 1;
+    for (size_t slot = hash & mask; ns_list->slots[slot].used; slot = (slot + 1) & mask) {
+        if (ns_list->slots[slot].hash == hash && strcmp(ns_list->slots[slot].nsp, nsp) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+esp_err_t grow_table(esp_socketio_ns_list_handle_t ns_list)
+{
+    size_t new_size = ns_list->size * 2;
+    esp_socketio_ns_t *new_slots = calloc(new_size, sizeof(esp_socketio_ns_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, new_slots, return ESP_ERR_NO_MEM);
+
+    for (size_t i = 0; i < ns_list->size; i++) {
+        if (!ns_list->slots[i].used) {
+            continue;
         }
-        if (temp->sid != NULL) {
-            free(temp->sid);
+        size_t slot = ns_list->slots[i].hash & (new_size - 1);
+        while (new_slots[slot].used) {
+            slot = (slot + 1) & (new_size - 1);
         }
-        free(temp);
+        new_slots[slot] = ns_list->slots[i];
     }
-    free(ns_list);
-    return;
+    free(ns_list->slots);
+    ns_list->slots = new_slots;
+    ns_list->size = new_size;
+    return ESP_OK;
+}
+
+void clear_slots(esp_socketio_ns_list_handle_t ns_list)
+{
+    for (size_t i = 0; i < ns_list->size; i++) {
+        if (ns_list->slots[i].used) {
+            free(ns_list->slots[i].sid);
+        }
+    }
+    memset(ns_list->slots, 0, ns_list->size * sizeof(esp_socketio_ns_t));
+    ns_list->num_namespaces = 0;
 }
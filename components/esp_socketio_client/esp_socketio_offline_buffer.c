@@ -0,0 +1,301 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "esp_socketio_offline_buffer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_socketio_internal.h"
+
+static const char *TAG = "socketio_offline";
+
+#define OFFLINE_ALIGN(len)          (((len) + 3) & ~(size_t)3)
+
+// Record in the ring, followed by `frame_num` frames, each a uint32_t length and the bytes, padded to 4 bytes
+typedef struct {
+    uint32_t    size;                                   // Whole record, this header included
+    uint16_t    frame_num;                              // 0 marks padding up to the end of the ring
+    bool        sent;                                   // Sent, waiting for the records before it to be freed
+    char        nsp[ESP_SOCKETIO_NSP_MAX_LEN + 1];
+} esp_socketio_offline_record_t;
+
+struct esp_socketio_offline_buffer {
+    uint8_t                         *ring;
+    size_t                          size;
+    size_t                          head;               // Oldest record
+    size_t                          tail;               // Where the next record is written
+    size_t                          used;               // Bytes taken by records and padding
+    esp_socketio_offline_policy_t   policy;
+    uint32_t                        dropped;
+    SemaphoreHandle_t               lock;
+};
+
+static esp_socketio_offline_record_t *record_at(esp_socketio_offline_buffer_handle_t buffer, size_t pos);
+static bool is_padding(esp_socketio_offline_buffer_handle_t buffer, size_t pos);
+static void skip_head_padding(esp_socketio_offline_buffer_handle_t buffer);
+static bool reserve(esp_socketio_offline_buffer_handle_t buffer, size_t len, size_t *pos_ptr);
+static void pop_record(esp_socketio_offline_buffer_handle_t buffer);
+static uint8_t *write_frame_header(uint8_t *pos, size_t len);
+static bool record_fits(const esp_socketio_offline_record_t *record, size_t max_frame);
+
+esp_socketio_offline_buffer_handle_t esp_socketio_offline_buffer_create(size_t size, esp_socketio_offline_policy_t policy)
+{
+    esp_socketio_offline_buffer_handle_t buffer = calloc(1, sizeof(struct esp_socketio_offline_buffer));
+    ESP_SOCKETIO_MEM_CHECK(TAG, buffer, return NULL);
+
+    buffer->size = OFFLINE_ALIGN(size);
+    buffer->ring = malloc(buffer->size);
+    ESP_SOCKETIO_MEM_CHECK(TAG, buffer->ring, goto error);
+    buffer->policy = policy;
+    buffer->lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, buffer->lock, goto error);
+    return buffer;
+
+error:
+    esp_socketio_offline_buffer_destroy(buffer);
+    return NULL;
+}
+
+esp_err_t esp_socketio_offline_buffer_store(esp_socketio_offline_buffer_handle_t buffer, esp_socketio_packet_handle_t packet)
+{
+    if (buffer == NULL || packet == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = esp_socketio_packet_encode_message(packet);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    int text_len = 0;
+    const char *text = esp_socketio_packet_get_raw_data(packet, &text_len);
+    int binary_count = esp_socketio_packet_count_binary_data(packet);
+
+    // Size the record first, so nothing is written if it does not fit
+    size_t len = sizeof(esp_socketio_offline_record_t) + OFFLINE_ALIGN(sizeof(uint32_t) + text_len);
+    unsigned char *binary = NULL;
+    size_t binary_size = 0;
+    esp_socketio_binary_reader_cb_t reader = NULL;
+    void *reader_arg = NULL;
+    for (int i = 0; i < binary_count; i++) {
+        if (esp_socketio_packet_get_binary_data(packet, i, &binary, &binary_size) != ESP_OK
+            && esp_socketio_packet_get_binary_reader(packet, i, &reader, &reader_arg, &binary_size) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        len += OFFLINE_ALIGN(sizeof(uint32_t) + binary_size);
+    }
+    if (len > buffer->size) {
+        ESP_LOGE(TAG, "Packet of %d bytes larger than the offline buffer", (int)len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(buffer->lock, portMAX_DELAY);
+    size_t pos = 0;
+    while (!reserve(buffer, len, &pos)) {
+        if (buffer->policy != SOCKETIO_OFFLINE_DROP_OLDEST || buffer->used == 0) {
+            xSemaphoreGive(buffer->lock);
+            ESP_LOGW(TAG, "Offline buffer full, dropping packet");
+            return ESP_ERR_NO_MEM;
+        }
+        pop_record(buffer);
+        buffer->dropped++;
+    }
+
+    esp_socketio_offline_record_t *record = record_at(buffer, pos);
+    uint8_t *frame = (uint8_t *)(record + 1);
+    frame = write_frame_header(frame, text_len);
+    memcpy(frame, text, text_len);
+    frame += OFFLINE_ALIGN(sizeof(uint32_t) + text_len) - sizeof(uint32_t);
+    for (int i = 0; i < binary_count && ret == ESP_OK; i++) {
+        if (esp_socketio_packet_get_binary_data(packet, i, &binary, &binary_size) == ESP_OK) {
+            frame = write_frame_header(frame, binary_size);
+            memcpy(frame, binary, binary_size);
+        } else {
+            esp_socketio_packet_get_binary_reader(packet, i, &reader, &reader_arg, &binary_size);
+            frame = write_frame_header(frame, binary_size);
+            for (size_t offset = 0; offset < binary_size;) {
+                int read_len = reader(frame + offset, offset, binary_size - offset, reader_arg);
+                if (read_len <= 0 || (size_t)read_len > binary_size - offset) {
+                    ESP_LOGE(TAG, "Binary reader failed at offset %d", (int)offset);
+                    ret = ESP_FAIL;
+                    break;
+                }
+                offset += read_len;
+            }
+        }
+        frame += OFFLINE_ALIGN(sizeof(uint32_t) + binary_size) - sizeof(uint32_t);
+    }
+
+    if (ret == ESP_OK) {
+        // Committed only once complete; reserve() has already accounted for the padding
+        record->size = len;
+        record->frame_num = 1 + binary_count;
+        record->sent = false;
+        strcpy(record->nsp, esp_socketio_packet_get_nsp(packet));
+        buffer->tail = (pos + len == buffer->size) ? 0 : pos + len;
+        buffer->used += len;
+    }
+    xSemaphoreGive(buffer->lock);
+    return ret;
+}
+
+int esp_socketio_offline_buffer_flush(esp_socketio_offline_buffer_handle_t buffer, size_t max_frame,
+                                      esp_socketio_offline_ready_cb_t ready_cb, esp_socketio_offline_send_cb_t send_cb, void *arg)
+{
+    if (buffer == NULL || ready_cb == NULL || send_cb == NULL) {
+        return 0;
+    }
+
+    int sent = 0;
+    xSemaphoreTake(buffer->lock, portMAX_DELAY);
+    size_t pos = buffer->head;
+    size_t remaining = buffer->used;
+    while (remaining > 0) {
+        if (is_padding(buffer, pos)) {
+            remaining -= buffer->size - pos;
+            pos = 0;
+            continue;
+        }
+
+        esp_socketio_offline_record_t *record = record_at(buffer, pos);
+        if (!record->sent && ready_cb(record->nsp, arg)) {
+            if (!record_fits(record, max_frame)) {
+                // Would be refused by the server on every connection
+                ESP_LOGE(TAG, "Dropping buffered packet with a frame larger than %d bytes", (int)max_frame);
+                buffer->dropped++;
+            } else {
+                const uint8_t *frame = (const uint8_t *)(record + 1);
+                esp_err_t ret = ESP_OK;
+                for (int i = 0; i < record->frame_num && ret == ESP_OK; i++) {
+                    uint32_t frame_len;
+                    memcpy(&frame_len, frame, sizeof(uint32_t));
+                    ret = send_cb(i, frame + sizeof(uint32_t), frame_len, arg);
+                    frame += OFFLINE_ALIGN(sizeof(uint32_t) + frame_len);
+                }
+                if (ret != ESP_OK) {
+                    // Disconnected again, the rest waits for the next connection
+                    break;
+                }
+                sent++;
+            }
+            record->sent = true;
+        }
+        remaining -= record->size;
+        pos = (pos + record->size == buffer->size) ? 0 : pos + record->size;
+    }
+
+    for (;;) {
+        skip_head_padding(buffer);
+        if (buffer->used == 0 || !record_at(buffer, buffer->head)->sent) {
+            break;
+        }
+        pop_record(buffer);
+    }
+    xSemaphoreGive(buffer->lock);
+    return sent;
+}
+
+void esp_socketio_offline_buffer_destroy(esp_socketio_offline_buffer_handle_t buffer)
+{
+    if (buffer == NULL) {
+        return;
+    }
+    if (buffer->dropped > 0) {
+        ESP_LOGW(TAG, "%" PRIu32 " packets were dropped by the offline buffer", buffer->dropped);
+    }
+    if (buffer->lock) {
+        vSemaphoreDelete(buffer->lock);
+    }
+    free(buffer->ring);
+    free(buffer);
+}
+
+esp_socketio_offline_record_t *record_at(esp_socketio_offline_buffer_handle_t buffer, size_t pos)
+{
+    return (esp_socketio_offline_record_t *)(buffer->ring + pos);
+}
+
+// The end of the ring is padding when a record did not fit there, or when it is too short for a header
+bool is_padding(esp_socketio_offline_buffer_handle_t buffer, size_t pos)
+{
+    return buffer->size - pos < sizeof(esp_socketio_offline_record_t) || record_at(buffer, pos)->frame_num == 0;
+}
+
+void skip_head_padding(esp_socketio_offline_buffer_handle_t buffer)
+{
+    if (buffer->used > 0 && is_padding(buffer, buffer->head)) {
+        buffer->used -= buffer->size - buffer->head;
+        buffer->head = 0;
+    }
+}
+
+bool reserve(esp_socketio_offline_buffer_handle_t buffer, size_t len, size_t *pos_ptr)
+{
+    if (buffer->used == 0) {
+        buffer->head = buffer->tail = 0;
+    } else if (buffer->tail == buffer->head) {
+        return false;
+    }
+
+    if (buffer->tail >= buffer->head) {
+        if (buffer->size - buffer->tail >= len) {
+            *pos_ptr = buffer->tail;
+            return true;
+        }
+        if (buffer->head < len) {
+            return false;
+        }
+        // Pad up to the end of the ring and write at the start
+        if (buffer->size - buffer->tail >= sizeof(esp_socketio_offline_record_t)) {
+            record_at(buffer, buffer->tail)->frame_num = 0;
+        }
+        buffer->used += buffer->size - buffer->tail;
+        buffer->tail = 0;
+        *pos_ptr = 0;
+        return true;
+    }
+
+    if (buffer->head - buffer->tail >= len) {
+        *pos_ptr = buffer->tail;
+        return true;
+    }
+    return false;
+}
+
+void pop_record(esp_socketio_offline_buffer_handle_t buffer)
+{
+    skip_head_padding(buffer);
+    if (buffer->used == 0) {
+        return;
+    }
+    esp_socketio_offline_record_t *record = record_at(buffer, buffer->head);
+    buffer->used -= record->size;
+    buffer->head = (buffer->head + record->size == buffer->size) ? 0 : buffer->head + record->size;
+}
+
+uint8_t *write_frame_header(uint8_t *pos, size_t len)
+{
+    uint32_t frame_len = len;
+    memcpy(pos, &frame_len, sizeof(uint32_t));
+    return pos + sizeof(uint32_t);
+}
+
+bool record_fits(const esp_socketio_offline_record_t *record, size_t max_frame)
+{
+    if (max_frame == 0) {
+        return true;
+    }
+    const uint8_t *frame = (const uint8_t *)(record + 1);
+    for (int i = 0; i < record->frame_num; i++) {
+        uint32_t frame_len;
+        memcpy(&frame_len, frame, sizeof(uint32_t));
+        if (frame_len > max_frame) {
+            return false;
+        }
+        frame += OFFLINE_ALIGN(sizeof(uint32_t) + frame_len);
+    }
+    return true;
+}
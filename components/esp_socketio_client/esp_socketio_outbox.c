@@ -0,0 +1,789 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "esp_socketio_outbox.h"
+#include "esp_socketio_packet.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_socketio_internal.h"
+
+static const char *TAG = "socketio_outbox";
+
+#define OUTBOX_RECORD_MAGIC         (0x4a4f4953)        // "SIOJ"
+#define OUTBOX_RECORD_HEADER_SIZE   (2 * sizeof(uint32_t))
+#define OUTBOX_RECORD_CRC_SIZE      (sizeof(uint32_t))
+#define OUTBOX_SEGMENT_NAME_LEN     (sizeof("/00000000.sio"))
+// Room left in front of a record read for draining, where the Socket.IO header is written
+#define OUTBOX_SIO_HEADER_MAX       (ESP_SOCKETIO_NSP_MAX_LEN + 32)
+// Attachments produced by a reader are appended through a buffer of this size
+#define OUTBOX_APPEND_CHUNK_SIZE    (256)
+
+/*
+ * A segment file is a sequence of records:
+ *     uint32_t magic, uint32_t payload length, payload, uint32_t CRC-32 of the payload
+ * and a payload is:
+ *     uint8_t Socket.IO type, uint8_t attachment count, namespace and '\0',
+ *     uint32_t JSON length, JSON, then for each attachment uint32_t length and bytes.
+ * A record cut by a power loss fails its CRC and ends the segment.
+ */
+
+typedef struct {
+    uint32_t    token;
+    uint32_t    seq;                // Segment of the record
+    uint32_t    start;              // Offset of the record
+    uint32_t    end;                // Offset following the record
+} esp_socketio_outbox_entry_t;
+
+// Frames of the record being sent, in the scratch buffer
+typedef struct {
+    const uint8_t   *text;              // Socket.IO header and JSON
+    size_t          text_len;
+    const uint8_t   *binary;            // Length-prefixed attachments
+    const uint8_t   *end;
+    int             binary_count;
+} esp_socketio_outbox_frames_t;
+
+struct esp_socketio_outbox {
+    char                            *path;              // Directory, followed by room for a segment name
+    size_t                          path_len;
+    size_t                          segment_size;
+    size_t                          max_segments;
+    esp_socketio_offline_policy_t   policy;
+    uint32_t                        head_seq;           // Oldest segment
+    uint32_t                        tail_seq;           // Newest segment
+    size_t                          segment_num;
+    int                             tail_fd;            // Segment appended to, -1 to start a new one
+    uint32_t                        tail_size;          // Size of the complete records of the appended segment
+    uint32_t                        read_seq;           // Next record to send
+    uint32_t                        read_off;
+    int                             read_fd;
+    esp_socketio_outbox_entry_t     inflight[CONFIG_ESP_SOCKETIO_OUTBOX_WINDOW];   // Sent, waiting for their ack
+    size_t                          inflight_len;
+    esp_socketio_outbox_entry_t     parked[CONFIG_ESP_SOCKETIO_OUTBOX_WINDOW];     // Skipped, their namespace was not ready
+    size_t                          parked_len;
+    uint32_t                        next_token;
+    uint8_t                         *scratch;           // Record being drained, only used by the draining task
+    uint8_t                         *append_chunk;      // Attachment read from a reader while appending
+    uint32_t                        dropped;
+    bool                            draining;           // A task is draining, possibly with the lock released
+    bool                            drain_again;        // Drain requested meanwhile, done by the draining task
+    SemaphoreHandle_t               lock;
+};
+
+static const char *segment_path(esp_socketio_outbox_handle_t outbox, uint32_t seq);
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+static esp_err_t append_bytes(esp_socketio_outbox_handle_t outbox, uint32_t *offset, const void *data, size_t len, uint32_t *crc);
+static esp_err_t start_segment(esp_socketio_outbox_handle_t outbox);
+static void drop_head_segment(esp_socketio_outbox_handle_t outbox);
+static bool load_record(esp_socketio_outbox_handle_t outbox, int fd, uint32_t offset, uint32_t *len_ptr);
+static bool read_record(esp_socketio_outbox_handle_t outbox, uint32_t *len_ptr);
+static bool read_parked(esp_socketio_outbox_handle_t outbox, const esp_socketio_outbox_entry_t *entry, uint32_t *len_ptr);
+static uint8_t *parse_record(esp_socketio_outbox_handle_t outbox, uint32_t len, esp_socketio_packet_header_t *header,
+                             uint32_t *json_len_ptr);
+static bool record_fits(esp_socketio_outbox_handle_t outbox, uint32_t len, size_t max_frame);
+static int drain_records(esp_socketio_outbox_handle_t outbox, size_t max_frame, esp_socketio_offline_ready_cb_t ready_cb,
+                         esp_socketio_outbox_track_cb_t track_cb, esp_socketio_offline_send_cb_t send_cb, void *arg);
+static esp_err_t prepare_record(esp_socketio_outbox_handle_t outbox, esp_socketio_outbox_entry_t *entry, uint32_t len,
+                                esp_socketio_outbox_track_cb_t track_cb, void *arg, esp_socketio_outbox_frames_t *frames);
+static esp_err_t send_frames(esp_socketio_outbox_handle_t outbox, const esp_socketio_outbox_frames_t *frames,
+                             esp_socketio_offline_send_cb_t send_cb, void *arg);
+static void remove_entry(esp_socketio_outbox_entry_t *entries, size_t *len_ptr, size_t index);
+static void collect_segments(esp_socketio_outbox_handle_t outbox);
+static void rewind_inflight(esp_socketio_outbox_handle_t outbox);
+
+esp_socketio_outbox_handle_t esp_socketio_outbox_create(const char *path, size_t segment_size, size_t max_segments,
+                                                        esp_socketio_offline_policy_t policy)
+{
+    if (path == NULL || segment_size < CONFIG_ESP_SOCKETIO_OUTBOX_RECORD_MAX_SIZE || max_segments == 0) {
+        return NULL;
+    }
+
+    esp_socketio_outbox_handle_t outbox = calloc(1, sizeof(struct esp_socketio_outbox));
+    ESP_SOCKETIO_MEM_CHECK(TAG, outbox, return NULL);
+    outbox->tail_fd = -1;
+    outbox->read_fd = -1;
+    outbox->segment_size = segment_size;
+    outbox->max_segments = max_segments;
+    outbox->policy = policy;
+
+    outbox->path_len = strlen(path);
+    outbox->path = malloc(outbox->path_len + OUTBOX_SEGMENT_NAME_LEN);
+    ESP_SOCKETIO_MEM_CHECK(TAG, outbox->path, goto error);
+    memcpy(outbox->path, path, outbox->path_len + 1);
+    outbox->scratch = malloc(OUTBOX_SIO_HEADER_MAX + CONFIG_ESP_SOCKETIO_OUTBOX_RECORD_MAX_SIZE);
+    ESP_SOCKETIO_MEM_CHECK(TAG, outbox->scratch, goto error);
+    outbox->append_chunk = malloc(OUTBOX_APPEND_CHUNK_SIZE);
+    ESP_SOCKETIO_MEM_CHECK(TAG, outbox->append_chunk, goto error);
+    outbox->lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, outbox->lock, goto error);
+
+    // Pick up the segments of a previous run
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        ESP_LOGE(TAG, "Cannot open outbox directory %s", path);
+        goto error;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint32_t seq;
+        char suffix[5];
+        if (strlen(entry->d_name) != OUTBOX_SEGMENT_NAME_LEN - 2
+            || sscanf(entry->d_name, "%8" SCNx32 ".%3s", &seq, suffix) != 2 || strcmp(suffix, "sio") != 0) {
+            continue;
+        }
+        if (outbox->segment_num == 0 || seq < outbox->head_seq) {
+            outbox->head_seq = seq;
+        }
+        if (outbox->segment_num == 0 || seq > outbox->tail_seq) {
+            outbox->tail_seq = seq;
+        }
+        outbox->segment_num++;
+    }
+    closedir(dir);
+    if (outbox->segment_num > 0) {
+        // Missing sequence numbers are read as empty segments
+        outbox->segment_num = outbox->tail_seq - outbox->head_seq + 1;
+        ESP_LOGI(TAG, "%d journal segments to send", (int)outbox->segment_num);
+    } else {
+        outbox->head_seq = outbox->tail_seq + 1;
+    }
+    outbox->read_seq = outbox->head_seq;
+    return outbox;
+
+error:
+    esp_socketio_outbox_destroy(outbox);
+    return NULL;
+}
+
+esp_err_t esp_socketio_outbox_append(esp_socketio_outbox_handle_t outbox, esp_socketio_packet_handle_t packet)
+{
+    if (outbox == NULL || packet == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = esp_socketio_packet_encode_message(packet);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    int raw_len = 0;
+    const char *raw = esp_socketio_packet_get_raw_data(packet, &raw_len);
+    esp_socketio_packet_header_t header;
+    if (esp_socketio_packet_parse_header(raw, raw_len, &header) != ESP_OK) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Drained packets get an ack id of the journal, which only an event can carry
+    if (header.sio_type != SIO_PACKET_TYPE_EVENT && header.sio_type != SIO_PACKET_TYPE_BINARY_EVENT) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    const char *nsp = esp_socketio_packet_get_nsp(packet);
+    uint32_t json_len = (header.payload != NULL) ? header.payload_len : 0;
+    int binary_count = esp_socketio_packet_count_binary_data(packet);
+
+    // Size the record first, so a packet that does not fit is rejected before anything is written
+    unsigned char *binary = NULL;
+    size_t binary_size = 0;
+    esp_socketio_binary_reader_cb_t reader = NULL;
+    void *reader_arg = NULL;
+    size_t len = 2 + strlen(nsp) + 1 + sizeof(uint32_t) + json_len;
+    for (int i = 0; i < binary_count; i++) {
+        if (esp_socketio_packet_get_binary_data(packet, i, &binary, &binary_size) != ESP_OK
+            && esp_socketio_packet_get_binary_reader(packet, i, &reader, &reader_arg, &binary_size) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        len += sizeof(uint32_t) + binary_size;
+    }
+    size_t record_len = OUTBOX_RECORD_HEADER_SIZE + len + OUTBOX_RECORD_CRC_SIZE;
+    if (binary_count > UINT8_MAX || record_len > CONFIG_ESP_SOCKETIO_OUTBOX_RECORD_MAX_SIZE) {
+        ESP_LOGE(TAG, "Packet of %d bytes larger than a journal record", (int)record_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(outbox->lock, portMAX_DELAY);
+    if (outbox->tail_fd < 0 || outbox->tail_size + record_len > outbox->segment_size) {
+        ret = start_segment(outbox);
+        if (ret != ESP_OK) {
+            xSemaphoreGive(outbox->lock);
+            return ret;
+        }
+    }
+
+    uint32_t offset = outbox->tail_size;
+    uint32_t crc = 0;
+    uint32_t fields[2] = { OUTBOX_RECORD_MAGIC, len };
+    uint8_t types[2] = { header.sio_type, binary_count };
+    if (lseek(outbox->tail_fd, offset, SEEK_SET) != (off_t)offset) {
+        ret = ESP_FAIL;
+    }
+    if (ret == ESP_OK) {
+        ret = append_bytes(outbox, &offset, fields, sizeof(fields), NULL);
+    }
+    if (ret == ESP_OK) {
+        ret = append_bytes(outbox, &offset, types, sizeof(types), &crc);
+    }
+    if (ret == ESP_OK) {
+        ret = append_bytes(outbox, &offset, nsp, strlen(nsp) + 1, &crc);
+    }
+    if (ret == ESP_OK) {
+        ret = append_bytes(outbox, &offset, &json_len, sizeof(uint32_t), &crc);
+    }
+    if (ret == ESP_OK && json_len > 0) {
+        ret = append_bytes(outbox, &offset, header.payload, json_len, &crc);
+    }
+    for (int i = 0; i < binary_count && ret == ESP_OK; i++) {
+        if (esp_socketio_packet_get_binary_data(packet, i, &binary, &binary_size) == ESP_OK) {
+            uint32_t frame_len = binary_size;
+            ret = append_bytes(outbox, &offset, &frame_len, sizeof(uint32_t), &crc);
+            if (ret == ESP_OK) {
+                ret = append_bytes(outbox, &offset, binary, binary_size, &crc);
+            }
+            continue;
+        }
+        esp_socketio_packet_get_binary_reader(packet, i, &reader, &reader_arg, &binary_size);
+        uint32_t frame_len = binary_size;
+        ret = append_bytes(outbox, &offset, &frame_len, sizeof(uint32_t), &crc);
+        for (size_t read_off = 0; read_off < binary_size && ret == ESP_OK;) {
+            size_t chunk_len = binary_size - read_off;
+            if (chunk_len > OUTBOX_APPEND_CHUNK_SIZE) {
+                chunk_len = OUTBOX_APPEND_CHUNK_SIZE;
+            }
+            int read_len = reader(outbox->append_chunk, read_off, chunk_len, reader_arg);
+            if (read_len <= 0 || (size_t)read_len > chunk_len) {
+                ESP_LOGE(TAG, "Binary reader failed at offset %d", (int)read_off);
+                ret = ESP_FAIL;
+                break;
+            }
+            ret = append_bytes(outbox, &offset, outbox->append_chunk, read_len, &crc);
+            read_off += read_len;
+        }
+    }
+    if (ret == ESP_OK) {
+        ret = append_bytes(outbox, &offset, &crc, sizeof(uint32_t), NULL);
+    }
+#if CONFIG_ESP_SOCKETIO_OUTBOX_FSYNC
+    if (ret == ESP_OK && fsync(outbox->tail_fd) != 0) {
+        ret = ESP_FAIL;
+    }
+#endif
+
+    if (ret == ESP_OK) {
+        outbox->tail_size = offset;
+    } else {
+        // The partial record ends this segment, the next packet starts a new one
+        ESP_LOGE(TAG, "Failed to append to %s", segment_path(outbox, outbox->tail_seq));
+        close(outbox->tail_fd);
+        outbox->tail_fd = -1;
+    }
+    xSemaphoreGive(outbox->lock);
+    return ret;
+}
+
+bool esp_socketio_outbox_is_empty(esp_socketio_outbox_handle_t outbox)
+{
+    if (outbox == NULL) {
+        return true;
+    }
+    xSemaphoreTake(outbox->lock, portMAX_DELAY);
+    bool empty = (outbox->segment_num == 0);
+    xSemaphoreGive(outbox->lock);
+    return empty;
+}
+
+int esp_socketio_outbox_drain(esp_socketio_outbox_handle_t outbox, size_t max_frame, esp_socketio_offline_ready_cb_t ready_cb,
+                              esp_socketio_outbox_track_cb_t track_cb, esp_socketio_offline_send_cb_t send_cb, void *arg)
+{
+    if (outbox == NULL || ready_cb == NULL || track_cb == NULL || send_cb == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(outbox->lock, portMAX_DELAY);
+    if (outbox->draining) {
+        // Left to the task already draining, so records are sent in order
+        outbox->drain_again = true;
+        xSemaphoreGive(outbox->lock);
+        return 0;
+    }
+    outbox->draining = true;
+    int sent = 0;
+    do {
+        outbox->drain_again = false;
+        sent += drain_records(outbox, max_frame, ready_cb, track_cb, send_cb, arg);
+    } while (outbox->drain_again);
+    outbox->draining = false;
+    // Dropped packets wait for no ack
+    collect_segments(outbox);
+    xSemaphoreGive(outbox->lock);
+    return sent;
+}
+
+void esp_socketio_outbox_ack(esp_socketio_outbox_handle_t outbox, uint32_t token, bool acked)
+{
+    if (outbox == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(outbox->lock, portMAX_DELAY);
+    for (size_t i = 0; i < outbox->inflight_len; i++) {
+        if (outbox->inflight[i].token != token) {
+            continue;
+        }
+        if (!acked) {
+            ESP_LOGW(TAG, "Journaled packet not acknowledged, sending again");
+            rewind_inflight(outbox);
+            break;
+        }
+        remove_entry(outbox->inflight, &outbox->inflight_len, i);
+        collect_segments(outbox);
+        break;
+    }
+    // Tokens not found belong to packets already sent again
+    xSemaphoreGive(outbox->lock);
+}
+
+void esp_socketio_outbox_destroy(esp_socketio_outbox_handle_t outbox)
+{
+    if (outbox == NULL) {
+        return;
+    }
+    if (outbox->dropped > 0) {
+        ESP_LOGW(TAG, "%" PRIu32 " journal segments were dropped", outbox->dropped);
+    }
+    if (outbox->tail_fd >= 0) {
+        close(outbox->tail_fd);
+    }
+    if (outbox->read_fd >= 0) {
+        close(outbox->read_fd);
+    }
+    if (outbox->lock) {
+        vSemaphoreDelete(outbox->lock);
+    }
+    free(outbox->scratch);
+    free(outbox->append_chunk);
+    free(outbox->path);
+    free(outbox);
+}
+
+const char *segment_path(esp_socketio_outbox_handle_t outbox, uint32_t seq)
+{
+    snprintf(outbox->path + outbox->path_len, OUTBOX_SEGMENT_NAME_LEN, "/%08" PRIx32 ".sio", seq);
+    return outbox->path;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+esp_err_t append_bytes(esp_socketio_outbox_handle_t outbox, uint32_t *offset, const void *data, size_t len, uint32_t *crc)
+{
+    const uint8_t *pos = data;
+    size_t remaining = len;
+    while (remaining > 0) {
+        ssize_t written = write(outbox->tail_fd, pos, remaining);
+        if (written <= 0) {
+            return ESP_FAIL;
+        }
+        pos += written;
+        remaining -= written;
+    }
+    if (crc != NULL) {
+        *crc = crc32_update(*crc, data, len);
+    }
+    *offset += len;
+    return ESP_OK;
+}
+
+esp_err_t start_segment(esp_socketio_outbox_handle_t outbox)
+{
+    if (outbox->tail_fd >= 0) {
+        close(outbox->tail_fd);
+        outbox->tail_fd = -1;
+    }
+    while (outbox->segment_num >= outbox->max_segments) {
+        if (outbox->policy != SOCKETIO_OFFLINE_DROP_OLDEST) {
+            ESP_LOGW(TAG, "Journal full, dropping packet");
+            return ESP_ERR_NO_MEM;
+        }
+        drop_head_segment(outbox);
+    }
+
+    uint32_t seq = outbox->tail_seq + 1;
+    // Also read while appended to, through the same descriptor, as some filesystems only share
+    // unsynced writes between the operations on one descriptor
+    int fd = open(segment_path(outbox, seq), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Cannot create %s", outbox->path);
+        return ESP_FAIL;
+    }
+    outbox->tail_fd = fd;
+    outbox->tail_seq = seq;
+    outbox->tail_size = 0;
+    if (outbox->segment_num++ == 0) {
+        outbox->head_seq = seq;
+    }
+    return ESP_OK;
+}
+
+void drop_head_segment(esp_socketio_outbox_handle_t outbox)
+{
+    // Acks of the dropped packets are ignored from now on
+    for (size_t i = outbox->inflight_len; i-- > 0;) {
+        if (outbox->inflight[i].seq == outbox->head_seq) {
+            remove_entry(outbox->inflight, &outbox->inflight_len, i);
+        }
+    }
+    for (size_t i = outbox->parked_len; i-- > 0;) {
+        if (outbox->parked[i].seq == outbox->head_seq) {
+            remove_entry(outbox->parked, &outbox->parked_len, i);
+        }
+    }
+    if (outbox->read_seq <= outbox->head_seq) {
+        if (outbox->read_fd >= 0) {
+            close(outbox->read_fd);
+            outbox->read_fd = -1;
+        }
+        outbox->read_seq = outbox->head_seq + 1;
+        outbox->read_off = 0;
+    }
+    unlink(segment_path(outbox, outbox->head_seq));
+    outbox->head_seq++;
+    outbox->segment_num--;
+    outbox->dropped++;
+}
+
+// Read the record at `offset` of `fd` into the scratch buffer, after OUTBOX_SIO_HEADER_MAX bytes
+bool load_record(esp_socketio_outbox_handle_t outbox, int fd, uint32_t offset, uint32_t *len_ptr)
+{
+    uint32_t fields[2];
+    uint32_t crc;
+    uint8_t *payload = outbox->scratch + OUTBOX_SIO_HEADER_MAX;
+    if (lseek(fd, offset, SEEK_SET) == (off_t)offset
+        && read(fd, fields, sizeof(fields)) == sizeof(fields)
+        && fields[0] == OUTBOX_RECORD_MAGIC
+        && fields[1] > 2 + 1 + sizeof(uint32_t)
+        && OUTBOX_RECORD_HEADER_SIZE + fields[1] + OUTBOX_RECORD_CRC_SIZE <= CONFIG_ESP_SOCKETIO_OUTBOX_RECORD_MAX_SIZE
+        && read(fd, payload, fields[1]) == (ssize_t)fields[1]
+        && read(fd, &crc, sizeof(crc)) == sizeof(crc)
+        && crc == crc32_update(0, payload, fields[1])
+        && memchr(&payload[2], '\0', fields[1] - 2 - sizeof(uint32_t)) != NULL) {
+        *len_ptr = fields[1];
+        return true;
+    }
+    return false;
+}
+
+// Read the record at the read position into the scratch buffer, moving to the next segment at the end of one
+bool read_record(esp_socketio_outbox_handle_t outbox, uint32_t *len_ptr)
+{
+    while (outbox->segment_num > 0 && outbox->read_seq <= outbox->tail_seq) {
+        bool appending = (outbox->read_seq == outbox->tail_seq && outbox->tail_fd >= 0);
+        if (appending && outbox->read_off >= outbox->tail_size) {
+            return false;
+        }
+        if (!appending && outbox->read_fd < 0) {
+            outbox->read_fd = open(segment_path(outbox, outbox->read_seq), O_RDONLY);
+        }
+        int fd = appending ? outbox->tail_fd : outbox->read_fd;
+        if (fd >= 0 && load_record(outbox, fd, outbox->read_off, len_ptr)) {
+            return true;
+        }
+        if (appending) {
+            ESP_LOGE(TAG, "Cannot read %s", outbox->path);
+            return false;
+        }
+
+        // End of a segment, or a record cut by a power loss
+        if (outbox->read_fd >= 0) {
+            close(outbox->read_fd);
+            outbox->read_fd = -1;
+        }
+        outbox->read_seq++;
+        outbox->read_off = 0;
+        collect_segments(outbox);
+    }
+    return false;
+}
+
+// Read a parked record into the scratch buffer, through the descriptor already open on its segment if any
+bool read_parked(esp_socketio_outbox_handle_t outbox, const esp_socketio_outbox_entry_t *entry, uint32_t *len_ptr)
+{
+    if (entry->seq == outbox->tail_seq && outbox->tail_fd >= 0) {
+        return load_record(outbox, outbox->tail_fd, entry->start, len_ptr);
+    }
+    if (entry->seq == outbox->read_seq && outbox->read_fd >= 0) {
+        return load_record(outbox, outbox->read_fd, entry->start, len_ptr);
+    }
+    int fd = open(segment_path(outbox, entry->seq), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool loaded = load_record(outbox, fd, entry->start, len_ptr);
+    close(fd);
+    return loaded;
+}
+
+// Locate the fields of the record loaded in the scratch buffer. Returns the position of its JSON.
+uint8_t *parse_record(esp_socketio_outbox_handle_t outbox, uint32_t len, esp_socketio_packet_header_t *header,
+                      uint32_t *json_len_ptr)
+{
+    uint8_t *payload = outbox->scratch + OUTBOX_SIO_HEADER_MAX;
+    const char *nsp = (const char *)&payload[2];
+    size_t nsp_len = strlen(nsp);
+    uint8_t *pos = payload + 2 + nsp_len + 1;
+    memcpy(json_len_ptr, pos, sizeof(uint32_t));
+    *header = (esp_socketio_packet_header_t) {
+        .eio_type = EIO_PACKET_TYPE_MESSAGE,
+        .sio_type = payload[0],
+        .binary_count = payload[1],
+        .nsp = nsp,
+        .nsp_len = nsp_len,
+        .event_id = -1,
+    };
+    return pos + sizeof(uint32_t);
+}
+
+// Whether every frame of the record loaded in the scratch buffer fits in `max_frame` bytes, with the longest ack id
+bool record_fits(esp_socketio_outbox_handle_t outbox, uint32_t len, size_t max_frame)
+{
+    if (max_frame == 0) {
+        return true;
+    }
+    esp_socketio_packet_header_t header;
+    uint32_t json_len;
+    const uint8_t *pos = parse_record(outbox, len, &header, &json_len);
+    const uint8_t *end = outbox->scratch + OUTBOX_SIO_HEADER_MAX + len;
+    header.event_id = INT_MAX;
+    char sio_header[OUTBOX_SIO_HEADER_MAX];
+    size_t header_len = 0;
+    if (esp_socketio_packet_encode_header(&header, sio_header, sizeof(sio_header), &header_len) != ESP_OK
+        || header_len + json_len > max_frame) {
+        return false;
+    }
+    pos += json_len;
+    for (int i = 0; i < header.binary_count && pos + sizeof(uint32_t) <= end; i++) {
+        uint32_t frame_len;
+        memcpy(&frame_len, pos, sizeof(uint32_t));
+        if (frame_len > max_frame) {
+            return false;
+        }
+        pos += sizeof(uint32_t) + frame_len;
+    }
+    return true;
+}
+
+// Called with the lock held, which is released while each record is sent
+int drain_records(esp_socketio_outbox_handle_t outbox, size_t max_frame, esp_socketio_offline_ready_cb_t ready_cb,
+                  esp_socketio_outbox_track_cb_t track_cb, esp_socketio_offline_send_cb_t send_cb, void *arg)
+{
+    int sent = 0;
+    uint32_t len = 0;
+    esp_err_t ret = ESP_OK;
+    esp_socketio_outbox_frames_t frames;
+    // Packets set aside go first once their namespace is ready
+    for (size_t i = 0; i < outbox->parked_len && outbox->inflight_len < CONFIG_ESP_SOCKETIO_OUTBOX_WINDOW;) {
+        esp_socketio_outbox_entry_t entry = outbox->parked[i];
+        if (!read_parked(outbox, &entry, &len)) {
+            ESP_LOGE(TAG, "Cannot read %s, dropping packet", outbox->path);
+            remove_entry(outbox->parked, &outbox->parked_len, i);
+            continue;
+        }
+        if (!ready_cb((const char *)&outbox->scratch[OUTBOX_SIO_HEADER_MAX + 2], arg)) {
+            i++;
+            continue;
+        }
+        if (!record_fits(outbox, len, max_frame)) {
+            ESP_LOGE(TAG, "Dropping journaled packet with a frame larger than %d bytes", (int)max_frame);
+            remove_entry(outbox->parked, &outbox->parked_len, i);
+            continue;
+        }
+        ret = prepare_record(outbox, &entry, len, track_cb, arg, &frames);
+        if (ret == ESP_ERR_NO_MEM) {
+            break;
+        }
+        remove_entry(outbox->parked, &outbox->parked_len, i);
+        if (ret == ESP_OK) {
+            ret = send_frames(outbox, &frames, send_cb, arg);
+        }
+        if (ret != ESP_OK) {
+            break;
+        }
+        sent++;
+    }
+
+    while (ret == ESP_OK && outbox->inflight_len < CONFIG_ESP_SOCKETIO_OUTBOX_WINDOW && read_record(outbox, &len)) {
+        const uint8_t *payload = outbox->scratch + OUTBOX_SIO_HEADER_MAX;
+        esp_socketio_outbox_entry_t entry = {
+            .seq = outbox->read_seq,
+            .start = outbox->read_off,
+            .end = outbox->read_off + OUTBOX_RECORD_HEADER_SIZE + len + OUTBOX_RECORD_CRC_SIZE,
+        };
+        if (payload[0] != SIO_PACKET_TYPE_EVENT && payload[0] != SIO_PACKET_TYPE_BINARY_EVENT) {
+            // Written by an older version, which journaled any packet
+            ESP_LOGW(TAG, "Dropping journaled packet of type %d", payload[0]);
+            outbox->read_off = entry.end;
+            continue;
+        }
+        if (!ready_cb((const char *)&payload[2], arg)) {
+            // Set aside, so that the packets of the other namespaces are not held behind it
+            if (outbox->parked_len == CONFIG_ESP_SOCKETIO_OUTBOX_WINDOW) {
+                break;
+            }
+            outbox->parked[outbox->parked_len++] = entry;
+            outbox->read_off = entry.end;
+            continue;
+        }
+        if (!record_fits(outbox, len, max_frame)) {
+            // Would be refused by the server on every connection
+            ESP_LOGE(TAG, "Dropping journaled packet with a frame larger than %d bytes", (int)max_frame);
+            outbox->read_off = entry.end;
+            continue;
+        }
+        ret = prepare_record(outbox, &entry, len, track_cb, arg, &frames);
+        if (ret == ESP_ERR_NO_MEM) {
+            break;
+        }
+        // Moved on before the lock is released, so an ack timeout meanwhile rewinds from a consistent position
+        outbox->read_off = entry.end;
+        if (ret == ESP_OK) {
+            ret = send_frames(outbox, &frames, send_cb, arg);
+        }
+        if (ret == ESP_OK) {
+            sent++;
+        }
+    }
+    return sent;
+}
+
+// Give the record loaded in the scratch buffer an ack id of the journal and encode its header. Once it has one,
+// the record waits for its ack even if sending fails: the ack times out and the record is sent again.
+esp_err_t prepare_record(esp_socketio_outbox_handle_t outbox, esp_socketio_outbox_entry_t *entry, uint32_t len,
+                         esp_socketio_outbox_track_cb_t track_cb, void *arg, esp_socketio_outbox_frames_t *frames)
+{
+    esp_socketio_packet_header_t header;
+    uint32_t json_len;
+    uint8_t *pos = parse_record(outbox, len, &header, &json_len);
+
+    entry->token = outbox->next_token;
+    header.event_id = track_cb(entry->token, arg);
+    if (header.event_id < 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    outbox->next_token++;
+    outbox->inflight[outbox->inflight_len++] = *entry;
+
+    // The payload was read after OUTBOX_SIO_HEADER_MAX bytes, the header is written just before the JSON
+    char sio_header[OUTBOX_SIO_HEADER_MAX];
+    size_t header_len = 0;
+    esp_err_t ret = esp_socketio_packet_encode_header(&header, sio_header, sizeof(sio_header), &header_len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    uint8_t *frame = pos - header_len;
+    memcpy(frame, sio_header, header_len);
+
+    *frames = (esp_socketio_outbox_frames_t) {
+        .text = frame,
+        .text_len = header_len + json_len,
+        .binary = pos + json_len,
+        .end = outbox->scratch + OUTBOX_SIO_HEADER_MAX + len,
+        .binary_count = header.binary_count,
+    };
+    return ESP_OK;
+}
+
+// Called with the lock held. It is released while sending, so appends and acks do not wait for the network;
+// the frames stay valid as only the draining task uses the scratch buffer.
+esp_err_t send_frames(esp_socketio_outbox_handle_t outbox, const esp_socketio_outbox_frames_t *frames,
+                      esp_socketio_offline_send_cb_t send_cb, void *arg)
+{
+    xSemaphoreGive(outbox->lock);
+    esp_err_t ret = send_cb(0, frames->text, frames->text_len, arg);
+    const uint8_t *pos = frames->binary;
+    for (int i = 1; i <= frames->binary_count && ret == ESP_OK && pos + sizeof(uint32_t) <= frames->end; i++) {
+        uint32_t frame_len;
+        memcpy(&frame_len, pos, sizeof(uint32_t));
+        pos += sizeof(uint32_t);
+        ret = send_cb(i, pos, frame_len, arg);
+        pos += frame_len;
+    }
+    xSemaphoreTake(outbox->lock, portMAX_DELAY);
+    return ret;
+}
+
+void remove_entry(esp_socketio_outbox_entry_t *entries, size_t *len_ptr, size_t index)
+{
+    memmove(&entries[index], &entries[index + 1], (*len_ptr - index - 1) * sizeof(esp_socketio_outbox_entry_t));
+    (*len_ptr)--;
+}
+
+// Delete the segments whose records are all sent and acknowledged
+void collect_segments(esp_socketio_outbox_handle_t outbox)
+{
+    // The appended segment too, once drained, so that nothing is sent twice after a restart
+    if (outbox->tail_fd >= 0 && outbox->inflight_len == 0 && outbox->parked_len == 0
+        && outbox->read_seq == outbox->tail_seq && outbox->read_off == outbox->tail_size) {
+        close(outbox->tail_fd);
+        outbox->tail_fd = -1;
+        if (outbox->read_fd >= 0) {
+            close(outbox->read_fd);
+            outbox->read_fd = -1;
+        }
+        outbox->read_seq++;
+        outbox->read_off = 0;
+    }
+
+    uint32_t live_seq = outbox->read_seq;
+    for (size_t i = 0; i < outbox->inflight_len; i++) {
+        if (outbox->inflight[i].seq < live_seq) {
+            live_seq = outbox->inflight[i].seq;
+        }
+    }
+    for (size_t i = 0; i < outbox->parked_len; i++) {
+        if (outbox->parked[i].seq < live_seq) {
+            live_seq = outbox->parked[i].seq;
+        }
+    }
+    while (outbox->segment_num > 0 && outbox->head_seq < live_seq) {
+        unlink(segment_path(outbox, outbox->head_seq));
+        outbox->head_seq++;
+        outbox->segment_num--;
+    }
+}
+
+// Read again from the oldest record sent or set aside. Records acknowledged since are sent again.
+void rewind_inflight(esp_socketio_outbox_handle_t outbox)
+{
+    uint32_t seq = outbox->read_seq;
+    uint32_t offset = outbox->read_off;
+    for (size_t i = 0; i < outbox->inflight_len + outbox->parked_len; i++) {
+        const esp_socketio_outbox_entry_t *entry = (i < outbox->inflight_len) ? &outbox->inflight[i]
+                                                   : &outbox->parked[i - outbox->inflight_len];
+        if (entry->seq < seq || (entry->seq == seq && entry->start < offset)) {
+            seq = entry->seq;
+            offset = entry->start;
+        }
+    }
+    if (outbox->read_fd >= 0 && outbox->read_seq != seq) {
+        close(outbox->read_fd);
+        outbox->read_fd = -1;
+    }
+    outbox->read_seq = seq;
+    outbox->read_off = offset;
+    outbox->inflight_len = 0;
+    outbox->parked_len = 0;
+}
@@ -5,41 +5,95 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
+#include <ctype.h>
+#include <stdatomic.h>
 #include "esp_socketio_packet.h"
 #include "esp_socketio_internal.h"
+#if CONFIG_ESP_SOCKETIO_JSON_ARENA
+#include "esp_socketio_json_arena.h"
+#endif
 
 static const char *TAG = "socketio_packet";
 static const char *default_nsp = "/";
-static const char *bin_placeholder = "_placeholder";
+
+#define SOCKETIO_PAYLOAD_MIN_CAPACITY   (64)
+#define SOCKETIO_BINARY_MIN_CAPACITY    (2)
+#define INT_DIGITS_MAX                  (10)
+#define SOCKETIO_ARGS_MIN_CAPACITY      (4)
 
 typedef struct esp_socketio_binary_data {
     uint8_t *buffer;
     size_t buffer_size;
-    int index;
-    struct esp_socketio_binary_data *next;
+    esp_socketio_binary_release_cb_t release_cb;    // NULL means the buffer is a copy owned by the packet
+    void *release_arg;
+    esp_socketio_binary_reader_cb_t reader;         // Set when the bytes are produced on send instead of stored
+    void *reader_arg;
+    uint8_t *copy;                                  // Buffer of the slot for copies, kept across resets
+    size_t copy_capacity;
 } esp_socketio_binary_data_t;
 
+typedef struct {
+    size_t offset;                                  // Position of the argument in json_buffer
+    size_t len;
+    cJSON *json;                                    // Decoded on first access
+    bool in_arena;                                  // json was parsed into json_arena
+} esp_socketio_json_span_t;
+
 struct esp_socketio_packet {
     esp_engineio_packet_type_t  eio_type;
     esp_socketio_packet_type_t  sio_type;
-    char                        *nsp;   // NULL means default namespace "/"
+    char                        nsp[ESP_SOCKETIO_NSP_MAX_LEN + 1];  // Empty means default namespace "/"
     int                         event_id;
     cJSON                       *json_payload;
     char                        *socketio_payload;
+    size_t                      payload_capacity;
     int                         data_len;
-    esp_socketio_binary_data_t  *binary_data_list;
-    int                         binary_data_count;
-    esp_socketio_binary_data_t  *current_binary_data;
+    esp_socketio_binary_data_t  *binary_data;           // Attachment table, indexed by placeholder number
+    int                         binary_data_num;        // Number of attachments in the table
+    int                         binary_data_capacity;
+    int                         binary_data_count;      // Number of attachments announced in the header
+    int                         current_binary_index;
+    char                        *json_buffer;           // Received payload whose JSON tree is built on demand, then the event name
+    size_t                      json_buffer_capacity;
+    size_t                      json_len;
+    bool                        json_pending;           // json_buffer holds a payload not decoded into json_payload yet
+    const char                  *event_name;
+    esp_socketio_json_span_t    *args;                  // Top-level array elements of the pending payload, event name included
+    int                         args_num;
+    int                         args_capacity;
+#if CONFIG_ESP_SOCKETIO_JSON_ARENA
+    esp_socketio_json_arena_handle_t json_arena;        // Received JSON trees, kept across resets
+#endif
+    bool                        json_in_arena;          // json_payload was parsed into json_arena
+    _Atomic uint32_t            refs;                   // Kept by reset and swap, like the recycle callback
+    esp_socketio_packet_recycle_cb_t recycle_cb;
+    void                        *recycle_arg;
 };
 
 static bool is_eio_packet_type_valid(char type);
 static bool is_sio_packet_type_valid(char eio_type, char sio_type);
 static bool is_json_valid(cJSON *json);
+static const char *parse_uint(const char *pos, const char *end, int *value_ptr);
+static char *write_uint(char *pos, unsigned int value);
+static esp_socketio_binary_data_t *append_binary_entry(esp_socketio_packet_handle_t packet);
+static void release_nothing(const unsigned char *data, size_t data_size, void *arg);
+static void clear_lazy_json(esp_socketio_packet_handle_t packet);
+static cJSON *parse_json(esp_socketio_packet_handle_t packet, const char *json, size_t len, bool *in_arena);
+static void delete_json_payload(esp_socketio_packet_handle_t packet);
+static bool has_event_name(esp_socketio_packet_handle_t packet);
+static esp_err_t measure_message(esp_socketio_packet_handle_t packet, size_t *capacity);
+#if CONFIG_ESP_SOCKETIO_LAZY_JSON
+static esp_err_t parse_lazy_json(esp_socketio_packet_handle_t packet, const char *json, size_t len);
+static esp_err_t scan_json_array(esp_socketio_packet_handle_t packet);
+static esp_err_t reserve_json_buffer(esp_socketio_packet_handle_t packet, size_t size);
+#endif
 
 esp_socketio_packet_handle_t esp_socketio_packet_init()
 {
     esp_socketio_packet_handle_t packet = calloc(1, sizeof(struct esp_socketio_packet));
     ESP_SOCKETIO_MEM_CHECK(TAG, packet, return NULL);
+    atomic_init(&packet->refs, 1);
 
     return packet;
 }
@@ -50,13 +104,15 @@ esp_err_t esp_socketio_packet_set_header(esp_socketio_packet_handle_t packet, es
         return ESP_ERR_INVALID_ARG;
     }
 
+    if (nsp != NULL && strlen(nsp) > ESP_SOCKETIO_NSP_MAX_LEN) {
+        ESP_LOGE(TAG, "Namespace \"%s\" is too long.", nsp);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
     esp_socketio_packet_reset(packet);
 
-    if (nsp != NULL) {
-        packet->nsp = calloc(1, strlen(nsp) + 1);
-        ESP_SOCKETIO_MEM_CHECK(TAG, packet->nsp, {
-            return ESP_ERR_NO_MEM;
-        });
+    // "/" is the default namespace and is never encoded
+    if (nsp != NULL && strcmp(nsp, default_nsp) != 0) {
         strcpy(packet->nsp, nsp);
     }
 
@@ -68,19 +124,43 @@ esp_err_t esp_socketio_packet_set_header(esp_socketio_packet_handle_t packet, es
 
 esp_err_t esp_socketio_packet_reset(esp_socketio_packet_handle_t packet)
 {
-    if (packet->nsp) {
-        free(packet->nsp);
-    }
-
     esp_socketio_packet_destroy_binary_data(packet);
 
-    if (packet->socketio_payload) {
-        free(packet->socketio_payload);
-    }
-
-    cJSON_Delete(packet->json_payload);
-
+    delete_json_payload(packet);
+    clear_lazy_json(packet);
+#if CONFIG_ESP_SOCKETIO_JSON_ARENA
+    // Frees every received tree at once
+    esp_socketio_json_arena_handle_t json_arena = packet->json_arena;
+    esp_socketio_json_arena_reset(json_arena);
+#endif
+
+    // Keep the buffers and tables so that the next packet does not allocate them
+    char *socketio_payload = packet->socketio_payload;
+    size_t payload_capacity = packet->payload_capacity;
+    esp_socketio_binary_data_t *binary_data = packet->binary_data;
+    int binary_data_capacity = packet->binary_data_capacity;
+    char *json_buffer = packet->json_buffer;
+    size_t json_buffer_capacity = packet->json_buffer_capacity;
+    esp_socketio_json_span_t *args = packet->args;
+    int args_capacity = packet->args_capacity;
+    uint32_t refs = atomic_load(&packet->refs);
+    esp_socketio_packet_recycle_cb_t recycle_cb = packet->recycle_cb;
+    void *recycle_arg = packet->recycle_arg;
     memset(packet, 0, sizeof(struct esp_socketio_packet));
+    packet->socketio_payload = socketio_payload;
+    packet->payload_capacity = payload_capacity;
+    packet->binary_data = binary_data;
+    packet->binary_data_capacity = binary_data_capacity;
+    packet->json_buffer = json_buffer;
+    packet->json_buffer_capacity = json_buffer_capacity;
+    packet->args = args;
+    packet->args_capacity = args_capacity;
+#if CONFIG_ESP_SOCKETIO_JSON_ARENA
+    packet->json_arena = json_arena;
+#endif
+    atomic_init(&packet->refs, refs);
+    packet->recycle_cb = recycle_cb;
+    packet->recycle_arg = recycle_arg;
     packet->event_id = -1;
     return ESP_OK;
 }
@@ -88,10 +168,56 @@ esp_err_t esp_socketio_packet_reset(esp_socketio_packet_handle_t packet)
 void esp_socketio_packet_destroy(esp_socketio_packet_handle_t packet)
 {
     esp_socketio_packet_reset(packet);
+    free(packet->socketio_payload);
+    for (int i = 0; i < packet->binary_data_capacity; i++) {
+        free(packet->binary_data[i].copy);
+    }
+    free(packet->binary_data);
+    free(packet->json_buffer);
+    free(packet->args);
+#if CONFIG_ESP_SOCKETIO_JSON_ARENA
+    esp_socketio_json_arena_destroy(packet->json_arena);
+#endif
     free(packet);
     return;
 }
 
+esp_socketio_packet_handle_t esp_socketio_packet_retain(esp_socketio_packet_handle_t packet)
+{
+    if (packet != NULL) {
+        atomic_fetch_add_explicit(&packet->refs, 1, memory_order_relaxed);
+    }
+    return packet;
+}
+
+void esp_socketio_packet_release(esp_socketio_packet_handle_t packet)
+{
+    // Acquire-release: whatever a holder wrote to the packet is visible to the one recycling it
+    if (packet == NULL || atomic_fetch_sub_explicit(&packet->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    atomic_store_explicit(&packet->refs, 1, memory_order_relaxed);
+    if (packet->recycle_cb != NULL) {
+        packet->recycle_cb(packet, packet->recycle_arg);
+    } else {
+        esp_socketio_packet_destroy(packet);
+    }
+}
+
+bool esp_socketio_packet_is_shared(esp_socketio_packet_handle_t packet)
+{
+    return packet != NULL && atomic_load_explicit(&packet->refs, memory_order_acquire) > 1;
+}
+
+void esp_socketio_packet_set_recycle_cb(esp_socketio_packet_handle_t packet, esp_socketio_packet_recycle_cb_t cb, void *arg)
+{
+    if (packet == NULL) {
+        return;
+    }
+    packet->recycle_cb = cb;
+    packet->recycle_arg = arg;
+}
+
 esp_engineio_packet_type_t esp_socketio_packet_get_eio_type(esp_socketio_packet_handle_t packet)
 {
     if (packet == NULL) {
@@ -113,7 +239,7 @@ char *esp_socketio_packet_get_nsp(esp_socketio_packet_handle_t packet)
     if (packet == NULL) {
         return NULL;
     }
-    if (packet->nsp == NULL) {
+    if (packet->nsp[0] == '\0') {
         return (char *)default_nsp;
     }
     return packet->nsp;
@@ -124,9 +250,62 @@ cJSON *esp_socketio_packet_get_json(esp_socketio_packet_handle_t packet)
     if (packet == NULL) {
         return NULL;
     }
+    if (packet->json_pending) {
+        packet->json_pending = false;
+        packet->json_payload = parse_json(packet, packet->json_buffer, packet->json_len, &packet->json_in_arena);
+        if (!is_json_valid(packet->json_payload)) {
+            ESP_LOGE(TAG, "Invalid Socket.IO json message received.");
+        }
+    }
     return packet->json_payload;
 }
 
+const char *esp_socketio_packet_get_event_name(esp_socketio_packet_handle_t packet)
+{
+    if (packet == NULL || !has_event_name(packet)) {
+        return NULL;
+    }
+    if (packet->event_name != NULL) {
+        return packet->event_name;
+    }
+    cJSON *name = cJSON_GetArrayItem(esp_socketio_packet_get_json(packet), 0);
+    return cJSON_IsString(name) ? name->valuestring : NULL;
+}
+
+int esp_socketio_packet_get_arg_count(esp_socketio_packet_handle_t packet)
+{
+    if (packet == NULL) {
+        return -1;
+    }
+    int first = has_event_name(packet) ? 1 : 0;
+    int count = (packet->args_num > 0) ? packet->args_num : cJSON_GetArraySize(esp_socketio_packet_get_json(packet));
+    return (count > first) ? count - first : 0;
+}
+
+cJSON *esp_socketio_packet_get_arg(esp_socketio_packet_handle_t packet, int index)
+{
+    if (packet == NULL || index < 0) {
+        return NULL;
+    }
+    index += has_event_name(packet) ? 1 : 0;
+
+    if (packet->args_num == 0) {
+        return cJSON_GetArrayItem(esp_socketio_packet_get_json(packet), index);
+    }
+    if (index >= packet->args_num) {
+        return NULL;
+    }
+
+    esp_socketio_json_span_t *arg = &packet->args[index];
+    if (arg->json == NULL) {
+        arg->json = parse_json(packet, packet->json_buffer + arg->offset, arg->len, &arg->in_arena);
+        if (!is_json_valid(arg->json)) {
+            ESP_LOGE(TAG, "Invalid Socket.IO json argument %d received.", index);
+        }
+    }
+    return arg->json;
+}
+
 char *esp_socketio_packet_get_raw_data(esp_socketio_packet_handle_t packet, int *data_len_ptr)
 {
     if (packet == NULL || data_len_ptr == NULL) {
@@ -144,12 +323,93 @@ int esp_socketio_packet_get_event_id(esp_socketio_packet_handle_t packet)
     return packet->event_id;
 }
 
+esp_err_t esp_socketio_packet_set_event_id(esp_socketio_packet_handle_t packet, int event_id)
+{
+    if (packet == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    packet->event_id = (event_id < 0) ? -1 : event_id;
+    return ESP_OK;
+}
+
+esp_err_t esp_socketio_packet_swap(esp_socketio_packet_handle_t packet, esp_socketio_packet_handle_t other)
+{
+    if (packet == NULL || other == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_socketio_packet tmp = *packet;
+    *packet = *other;
+    *other = tmp;
+    // Only the contents move, each handle keeps its references and owner
+    esp_socketio_packet_recycle_cb_t recycle_cb = packet->recycle_cb;
+    void *recycle_arg = packet->recycle_arg;
+    uint32_t refs = atomic_load(&packet->refs);
+    packet->recycle_cb = other->recycle_cb;
+    packet->recycle_arg = other->recycle_arg;
+    atomic_store(&packet->refs, atomic_load(&other->refs));
+    other->recycle_cb = recycle_cb;
+    other->recycle_arg = recycle_arg;
+    atomic_store(&other->refs, refs);
+    return ESP_OK;
+}
+
 esp_err_t esp_socketio_packet_set_json(esp_socketio_packet_handle_t packet, const cJSON *json)
 {
     if (packet == NULL || json == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
-    packet->json_payload = cJSON_Duplicate(json, true);
+    cJSON *copy = cJSON_Duplicate(json, true);
+    ESP_SOCKETIO_MEM_CHECK(TAG, copy, return ESP_ERR_NO_MEM);
+    delete_json_payload(packet);
+    clear_lazy_json(packet);
+    packet->json_payload = copy;
+    return ESP_OK;
+}
+
+esp_err_t esp_socketio_packet_take_json(esp_socketio_packet_handle_t packet, cJSON *json)
+{
+    if (packet == NULL || json == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (packet->json_payload != json) {
+        delete_json_payload(packet);
+        packet->json_payload = json;
+    }
+    clear_lazy_json(packet);
+    return ESP_OK;
+}
+
+cJSON *esp_socketio_packet_create_json_array(esp_socketio_packet_handle_t packet)
+{
+    if (packet == NULL) {
+        return NULL;
+    }
+    cJSON *array = cJSON_CreateArray();
+    ESP_SOCKETIO_MEM_CHECK(TAG, array, return NULL);
+    delete_json_payload(packet);
+    clear_lazy_json(packet);
+    packet->json_payload = array;
+    return array;
+}
+
+esp_err_t esp_socketio_packet_reserve_binary_data(esp_socketio_packet_handle_t packet, int num)
+{
+    if (packet == NULL || num < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (num <= packet->binary_data_capacity) {
+        return ESP_OK;
+    }
+    if ((size_t)num > SIZE_MAX / sizeof(esp_socketio_binary_data_t)) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_socketio_binary_data_t *table = realloc(packet->binary_data, num * sizeof(esp_socketio_binary_data_t));
+    ESP_SOCKETIO_MEM_CHECK(TAG, table, return ESP_ERR_NO_MEM);
+    memset(table + packet->binary_data_capacity, 0, (num - packet->binary_data_capacity) * sizeof(esp_socketio_binary_data_t));
+    packet->binary_data = table;
+    packet->binary_data_capacity = num;
     return ESP_OK;
 }
 
@@ -158,52 +418,118 @@ int esp_socketio_packet_add_binary_data(esp_socketio_packet_handle_t packet, con
     if (packet == NULL || data == NULL) {
         return -1;
     }
-    esp_socketio_binary_data_t *new_binary = (esp_socketio_binary_data_t *)malloc(sizeof(esp_socketio_binary_data_t));
-    ESP_SOCKETIO_MEM_CHECK(TAG, new_binary, return -1);
 
-    new_binary->buffer = (unsigned char *)malloc(data_size);
-    ESP_SOCKETIO_MEM_CHECK(TAG, new_binary->buffer, {
-        free(new_binary);
+    esp_socketio_binary_data_t *entry = append_binary_entry(packet);
+    if (entry == NULL) {
         return -1;
-    });
-
-    memcpy(new_binary->buffer, data, data_size);
-    new_binary->buffer_size = data_size;
-    new_binary->index = (packet->binary_data_list == NULL) ? 0 : packet->binary_data_list->index + 1;
-    new_binary->next = NULL;
-    if (packet->binary_data_list == NULL) {
-        packet->binary_data_list = new_binary;
-        packet->current_binary_data = new_binary;
-    } else {
-        esp_socketio_binary_data_t *current = packet->binary_data_list;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = new_binary;
     }
 
+    if (entry->copy == NULL || entry->copy_capacity < data_size) {
+        // Only grown, so a steady flow of attachments of similar sizes stops allocating
+        uint8_t *copy = malloc((data_size > 0) ? data_size : 1);
+        ESP_SOCKETIO_MEM_CHECK(TAG, copy, return -1);
+        free(entry->copy);
+        entry->copy = copy;
+        entry->copy_capacity = data_size;
+    }
+    memcpy(entry->copy, data, data_size);
+    entry->buffer = entry->copy;
+    entry->buffer_size = data_size;
+    entry->release_cb = NULL;
+    entry->release_arg = NULL;
+    entry->reader = NULL;
+
     if (increment) {
         packet->binary_data_count++;
     }
-    return new_binary->index;
+    return packet->binary_data_num++;
+}
+
+int esp_socketio_packet_add_binary_data_ref(esp_socketio_packet_handle_t packet, const unsigned char *data, size_t data_size,
+        esp_socketio_binary_release_cb_t release_cb, void *release_arg)
+{
+    if (packet == NULL || data == NULL) {
+        return -1;
+    }
+
+    esp_socketio_binary_data_t *entry = append_binary_entry(packet);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    entry->buffer = (unsigned char *)data;
+    entry->buffer_size = data_size;
+    entry->release_cb = (release_cb != NULL) ? release_cb : release_nothing;
+    entry->release_arg = release_arg;
+    entry->reader = NULL;
+    packet->binary_data_count++;
+    return packet->binary_data_num++;
+}
+
+int esp_socketio_packet_add_binary_reader(esp_socketio_packet_handle_t packet, size_t data_size,
+        esp_socketio_binary_reader_cb_t reader, void *reader_arg)
+{
+    if (packet == NULL || reader == NULL) {
+        return -1;
+    }
+
+    esp_socketio_binary_data_t *entry = append_binary_entry(packet);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    entry->buffer = NULL;
+    entry->buffer_size = data_size;
+    entry->release_cb = NULL;
+    entry->release_arg = NULL;
+    entry->reader = reader;
+    entry->reader_arg = reader_arg;
+    packet->binary_data_count++;
+    return packet->binary_data_num++;
+}
+
+esp_err_t esp_socketio_packet_get_binary_reader(esp_socketio_packet_handle_t packet, int index,
+        esp_socketio_binary_reader_cb_t *reader_ptr, void **reader_arg_ptr, size_t *data_size_ptr)
+{
+    if (packet == NULL || reader_ptr == NULL || reader_arg_ptr == NULL || data_size_ptr == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (index < 0 || index >= packet->binary_data_num || packet->binary_data[index].reader == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *reader_ptr = packet->binary_data[index].reader;
+    *reader_arg_ptr = packet->binary_data[index].reader_arg;
+    *data_size_ptr = packet->binary_data[index].buffer_size;
+    return ESP_OK;
+}
+
+void esp_socketio_packet_release_binary_data_ref(esp_socketio_packet_handle_t packet, int index)
+{
+    if (packet == NULL || index < 0 || index >= packet->binary_data_num) {
+        return;
+    }
+
+    esp_socketio_binary_data_t *entry = &packet->binary_data[index];
+    if (entry->release_cb == NULL || entry->buffer == NULL) {
+        return;
+    }
+    entry->release_cb(entry->buffer, entry->buffer_size, entry->release_arg);
+    entry->buffer = NULL;
 }
 
 void esp_socketio_packet_destroy_binary_data(esp_socketio_packet_handle_t packet)
 {
-    if (packet == NULL || packet->binary_data_list == NULL) {
+    if (packet == NULL) {
         return;
     }
 
-    esp_socketio_binary_data_t *current = packet->binary_data_list;
-    esp_socketio_binary_data_t *next = NULL;
-    while (current != NULL) {
-        next = current->next;
-        free(current->buffer);
-        free(current);
-        current = next;
+    // Copies stay in the buffers of their slots
+    for (int i = 0; i < packet->binary_data_num; i++) {
+        esp_socketio_packet_release_binary_data_ref(packet, i);
     }
-    packet->binary_data_list = NULL;
-    packet->current_binary_data = NULL;
+    packet->binary_data_num = 0;
+    packet->current_binary_index = 0;
 }
 
 int esp_socketio_packet_count_binary_data(esp_socketio_packet_handle_t packet)
@@ -220,15 +546,21 @@ int esp_socketio_packet_get_last_binary_index(esp_socketio_packet_handle_t packe
     if (packet == NULL) {
         return -1;
     }
-    esp_socketio_binary_data_t *current = packet->binary_data_list;
+    return packet->binary_data_num - 1;
+}
 
-    if (current == NULL) {
-        return -1;
+esp_err_t esp_socketio_packet_get_binary_data(esp_socketio_packet_handle_t packet, int index, unsigned char **data_ptr, size_t *data_size_ptr)
+{
+    if (packet == NULL || data_ptr == NULL || data_size_ptr == NULL) {
+        return ESP_ERR_INVALID_ARG;
     }
-    while (current->next != NULL) {
-        current = current->next;
+
+    if (index < 0 || index >= packet->binary_data_num || packet->binary_data[index].buffer == NULL) {
+        return ESP_ERR_NOT_FOUND;
     }
-    return current->index;
+    *data_ptr = packet->binary_data[index].buffer;
+    *data_size_ptr = packet->binary_data[index].buffer_size;
+    return ESP_OK;
 }
 
 esp_err_t esp_socketio_packet_get_current_binary_data(esp_socketio_packet_handle_t packet, unsigned char **data_ptr, size_t *data_size_ptr, int *index_ptr)
@@ -237,16 +569,13 @@ esp_err_t esp_socketio_packet_get_current_binary_data(esp_socketio_packet_handle
         return ESP_ERR_INVALID_ARG;
     }
 
-    if (packet->current_binary_data == NULL) {
+    if (esp_socketio_packet_get_binary_data(packet, packet->current_binary_index, data_ptr, data_size_ptr) != ESP_OK) {
         ESP_LOGI(TAG, "No more binary data.");
         *data_ptr = NULL;
         *data_size_ptr = 0;
         *index_ptr = -1;
     } else {
-        *data_ptr = packet->current_binary_data->buffer;
-        *data_size_ptr = packet->current_binary_data->buffer_size;
-        *index_ptr = packet->current_binary_data->index;
-        packet->current_binary_data = packet->current_binary_data->next;
+        *index_ptr = packet->current_binary_index++;
     }
     return ESP_OK;
 }
@@ -258,7 +587,7 @@ esp_err_t esp_socketio_parse_open_packet(const char *buf, int len, char *sid_ptr
     }
 
     // parse the JSON data
-    cJSON *json = cJSON_Parse(buf);
+    cJSON *json = cJSON_ParseWithLength(buf, len);
     if (!is_json_valid(json)) {
         return ESP_FAIL;
     }
@@ -306,9 +635,9 @@ esp_err_t esp_socketio_parse_open_packet(const char *buf, int len, char *sid_ptr
     return ESP_OK;
 }
 
-esp_err_t esp_socketio_packet_parse_message(esp_socketio_packet_handle_t packet, const char *buf, int len)
+esp_err_t esp_socketio_packet_parse_header(const char *buf, int len, esp_socketio_packet_header_t *header)
 {
-    if (packet == NULL || buf == NULL || !is_sio_packet_type_valid(buf[0], buf[1])) {
+    if (buf == NULL || header == NULL || len < 2) {
         return ESP_ERR_INVALID_ARG;
     }
 
@@ -317,161 +646,254 @@ esp_err_t esp_socketio_packet_parse_message(esp_socketio_packet_handle_t packet,
         return ESP_ERR_INVALID_ARG;
     }
 
-    esp_socketio_packet_reset(packet);
-    packet->eio_type = (esp_engineio_packet_type_t)buf[0];
-    packet->sio_type = (esp_socketio_packet_type_t)buf[1];
-    char *nsp = NULL;
-    cJSON *json = NULL;
-    char *slash_pos = strchr(buf, '/');
-    char *open_square_pos = strchr(buf, '[');
-    char *comma_pos = strchr(buf, ',');
-    if (slash_pos != NULL) {
-        if (comma_pos != NULL && (open_square_pos == NULL || comma_pos < open_square_pos)) {
-            // A custom namespace has been found
-            int nsp_len = comma_pos - slash_pos;
-            nsp = calloc(1, nsp_len + 1);
-            ESP_SOCKETIO_MEM_CHECK(TAG, nsp, {
-                return ESP_ERR_NO_MEM;
-            });
-            memcpy(nsp, slash_pos, nsp_len);
-            ESP_LOGI(TAG, "Custom namespace: \"%s\"", nsp);
-            packet->nsp = nsp;
+    if (!is_sio_packet_type_valid(buf[0], buf[1])) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // <eio type><sio type>[<attachments>-][<namespace>,][<event id>][<payload>]
+    const char *pos = &buf[2];
+    const char *end = buf + len;
+    memset(header, 0, sizeof(esp_socketio_packet_header_t));
+    header->eio_type = (esp_engineio_packet_type_t)buf[0];
+    header->sio_type = (esp_socketio_packet_type_t)buf[1];
+    header->event_id = -1;
+
+    if (header->sio_type == SIO_PACKET_TYPE_BINARY_EVENT || header->sio_type == SIO_PACKET_TYPE_BINARY_ACK) {
+        pos = parse_uint(pos, end, &header->binary_count);
+        if (pos == NULL || pos >= end || *pos != '-') {
+            ESP_LOGE(TAG, "Error parsing binary count.");
+            return ESP_ERR_NOT_FOUND;
+        }
+        // The count sizes the attachment table, so it is not left to the server
+        if (header->binary_count > CONFIG_ESP_SOCKETIO_MAX_BINARY_COUNT) {
+            ESP_LOGE(TAG, "Binary count %d exceeds %d.", header->binary_count, CONFIG_ESP_SOCKETIO_MAX_BINARY_COUNT);
+            return ESP_ERR_INVALID_SIZE;
         }
+        pos++;
     }
 
-    switch (packet->sio_type)
-    {
-    case SIO_PACKET_TYPE_CONNECT:
-    case SIO_PACKET_TYPE_CONNECT_ERROR:
-        char *open_brace_pos = strchr(buf, '{');
-        json = cJSON_Parse(open_brace_pos);
-        break;
-
-    case SIO_PACKET_TYPE_EVENT:
-    case SIO_PACKET_TYPE_ACK:
-    case SIO_PACKET_TYPE_BINARY_EVENT:
-    case SIO_PACKET_TYPE_BINARY_ACK:
-        char *end_ptr;
-        json = cJSON_Parse(open_square_pos);
-        if (packet->sio_type == SIO_PACKET_TYPE_BINARY_EVENT || packet->sio_type == SIO_PACKET_TYPE_BINARY_ACK) {
-            long bin_num = strtol(&buf[2], &end_ptr, 10);
-            if (end_ptr == &buf[2] || end_ptr[0] != '-') {
-                ESP_LOGE(TAG, "Error parsing binary count.");
-                esp_socketio_packet_reset(packet);
-                return ESP_ERR_NOT_FOUND;
-            }
+    if (pos < end && *pos == '/') {
+        header->nsp = pos;
+        while (pos < end && *pos != ',') {
+            pos++;
+        }
+        header->nsp_len = pos - header->nsp;
+        if (pos < end) {
+            pos++;
+        }
+    }
 
-            int placeholder_count = 0;
-            char *pos = (char *)buf;
-            while ((pos = strstr(pos, bin_placeholder)) != NULL) {
-                placeholder_count++;
-                pos += strlen(bin_placeholder);
-            }
+    if (pos < end && *pos >= '0' && *pos <= '9') {
+        pos = parse_uint(pos, end, &header->event_id);
+        if (pos == NULL) {
+            ESP_LOGE(TAG, "Error parsing event ID.");
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
 
-            if (placeholder_count != bin_num) {
-                ESP_LOGE(TAG, "Binary data count doesn't match with number of _placeholder");
-                esp_socketio_packet_reset(packet);
-                return ESP_ERR_NOT_FOUND;
-            }
+    if (pos < end) {
+        header->payload = pos;
+        header->payload_len = end - pos;
+    }
+    return ESP_OK;
+}
 
-            packet->binary_data_count = bin_num;
-        }
+esp_err_t esp_socketio_packet_parse_message(esp_socketio_packet_handle_t packet, const char *buf, int len)
+{
+    if (packet == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-        char *event_id_pos = NULL;
-        if (packet->nsp != NULL) {
-            event_id_pos = comma_pos + 1;
-        } else if (packet->binary_data_count > 0) {
-            event_id_pos = strchr(buf, '-') + 1;
-        } else {
-            event_id_pos = (char *)&buf[2];
+    esp_socketio_packet_header_t header;
+    esp_err_t ret = esp_socketio_packet_parse_header(buf, len, &header);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (header.nsp_len > ESP_SOCKETIO_NSP_MAX_LEN) {
+        ESP_LOGE(TAG, "Namespace \"%.*s\" is too long.", header.nsp_len, header.nsp);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_socketio_packet_reset(packet);
+    packet->eio_type = header.eio_type;
+    packet->sio_type = header.sio_type;
+    packet->event_id = header.event_id;
+    packet->binary_data_count = header.binary_count;
+    if (header.nsp != NULL) {
+        memcpy(packet->nsp, header.nsp, header.nsp_len);
+        packet->nsp[header.nsp_len] = '\0';
+    }
+
+    if (header.payload == NULL) {
+        // Only CONNECT and DISCONNECT may come without payload
+        if (header.sio_type == SIO_PACKET_TYPE_CONNECT || header.sio_type == SIO_PACKET_TYPE_DISCONNECT) {
+            return ESP_OK;
         }
+        ESP_LOGE(TAG, "No payload in Socket.IO message.");
+        esp_socketio_packet_reset(packet);
+        return ESP_ERR_NOT_FOUND;
+    }
 
-        if (event_id_pos != open_square_pos) {
-            ESP_LOGI(TAG, "Parsing event ID.");
-            long event_id = strtol(event_id_pos, &end_ptr, 10);
-            if (end_ptr == event_id_pos || end_ptr[0] != '[') {
-                ESP_LOGE(TAG, "Error parsing event ID.");
-                esp_socketio_packet_reset(packet);
-                return ESP_ERR_NOT_FOUND;
-            }
-            packet->event_id = event_id;
+#if CONFIG_ESP_SOCKETIO_LAZY_JSON
+    if (header.sio_type == SIO_PACKET_TYPE_EVENT || header.sio_type == SIO_PACKET_TYPE_ACK
+        || header.sio_type == SIO_PACKET_TYPE_BINARY_EVENT || header.sio_type == SIO_PACKET_TYPE_BINARY_ACK) {
+        if (parse_lazy_json(packet, header.payload, header.payload_len) != ESP_OK) {
+            ESP_LOGE(TAG, "Invalid Socket.IO json message received.");
+            esp_socketio_packet_reset(packet);
+            return ESP_ERR_NOT_FOUND;
         }
-        break;
-    
-    default:
-        break;
+        return ESP_OK;
     }
+#endif
 
+    bool in_arena;
+    cJSON *json = parse_json(packet, header.payload, header.payload_len, &in_arena);
     if (!is_json_valid(json)) {
         ESP_LOGE(TAG, "Invalid Socket.IO json message received.");
         esp_socketio_packet_reset(packet);
         return ESP_ERR_NOT_FOUND;
     }
     packet->json_payload = json;
+    packet->json_in_arena = in_arena;
     return ESP_OK;
 }
 
-esp_err_t esp_socketio_packet_encode_message(esp_socketio_packet_handle_t packet)
+esp_err_t esp_socketio_packet_encode_header(const esp_socketio_packet_header_t *header, char *buf, size_t buf_size, size_t *out_len)
 {
-    char *json_string = NULL;
-    if (packet == NULL || packet->eio_type != EIO_PACKET_TYPE_MESSAGE || !is_sio_packet_type_valid(packet->eio_type, packet->sio_type)) {
+    if (header == NULL || buf == NULL || out_len == NULL || header->eio_type != EIO_PACKET_TYPE_MESSAGE
+        || !is_sio_packet_type_valid(header->eio_type, header->sio_type)) {
         return ESP_ERR_INVALID_ARG;
     }
-    packet->data_len = 2; // eio_type + sio_type
 
-    int binary_count = esp_socketio_packet_count_binary_data(packet);
-    if (binary_count > 0) {
-        packet->data_len += snprintf(NULL, 0, "%d-", binary_count);
+    // "/" is the default namespace and is never encoded
+    int nsp_len = header->nsp_len;
+    if (header->nsp == NULL || (nsp_len == 1 && header->nsp[0] == '/')) {
+        nsp_len = 0;
     }
 
-    if (packet->nsp != NULL) {
-        packet->data_len += strlen(packet->nsp) + 1; // Namespace length + delimiter ","
+    // Worst case: types + "<count>-" + "<nsp>," + "<id>" + '\0'
+    if (buf_size < (size_t)(2 + (INT_DIGITS_MAX + 1) + (nsp_len + 1) + INT_DIGITS_MAX + 1)) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    if (packet->event_id >= 0) {
-        packet->data_len += snprintf(NULL, 0, "%d", packet->event_id);
+    char *ptr = buf;
+    *ptr++ = header->eio_type;
+    *ptr++ = header->sio_type;
+    if (header->binary_count > 0) {
+        ptr = write_uint(ptr, header->binary_count);
+        *ptr++ = '-';
     }
 
-    json_string = cJSON_PrintUnformatted(packet->json_payload);
-    if (json_string != NULL) {
-        packet->data_len += strlen(json_string);
+    if (nsp_len > 0) {
+        memcpy(ptr, header->nsp, nsp_len);
+        ptr += nsp_len;
+        *ptr++ = ',';
     }
 
-    if (packet->socketio_payload != NULL) {
-        free(packet->socketio_payload);
+    if (header->event_id >= 0) {
+        ptr = write_uint(ptr, header->event_id);
     }
-    packet->socketio_payload = malloc(packet->data_len + 1);
-    ESP_SOCKETIO_MEM_CHECK(TAG, packet->socketio_payload, {
-        if (json_string != NULL) {
-            free(json_string);
-        }
-        return ESP_ERR_NO_MEM;
-    })
+    *ptr = '\0';
+    *out_len = ptr - buf;
+    return ESP_OK;
+}
 
-    char *ptr = packet->socketio_payload;
-    ptr += sprintf(ptr, "%c%c", packet->eio_type, packet->sio_type);
-    if (binary_count > 0) {
-        ptr += sprintf(ptr, "%d-", binary_count);
+esp_err_t esp_socketio_packet_encode_to_buffer(esp_socketio_packet_handle_t packet, char *buf, size_t buf_size, size_t *out_len)
+{
+    if (packet == NULL || buf == NULL || out_len == NULL) {
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (packet->nsp != NULL) {
-        ptr += sprintf(ptr, "%s,", packet->nsp);
+    esp_socketio_packet_header_t header = {
+        .eio_type = packet->eio_type,
+        .sio_type = packet->sio_type,
+        .binary_count = packet->binary_data_count,
+        .nsp = packet->nsp,
+        .nsp_len = strlen(packet->nsp),
+        .event_id = packet->event_id,
+    };
+    size_t header_len = 0;
+    esp_err_t ret = esp_socketio_packet_encode_header(&header, buf, buf_size, &header_len);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
-    if (packet->event_id >= 0) {
-        ptr += sprintf(ptr, "%d", packet->event_id);
+    cJSON *json = esp_socketio_packet_get_json(packet);
+    if (json == NULL) {
+        *out_len = header_len;
+        return ESP_OK;
     }
 
-    if (json_string != NULL) {
-        sprintf(ptr, "%s", json_string);
-        free(json_string);
+    if (!cJSON_PrintPreallocated(json, buf + header_len, buf_size - header_len, false)) {
+        return ESP_ERR_INVALID_SIZE;
     }
+    *out_len = header_len + strlen(buf + header_len);
+    return ESP_OK;
+}
+
+esp_err_t esp_socketio_packet_encode_message(esp_socketio_packet_handle_t packet)
+{
+    if (packet == NULL || packet->eio_type != EIO_PACKET_TYPE_MESSAGE || !is_sio_packet_type_valid(packet->eio_type, packet->sio_type)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The payload buffer is kept across resets, so it only grows until it fits the largest message
+    size_t encoded_len = 0;
+    esp_err_t ret = ESP_ERR_INVALID_SIZE;
+    if (packet->socketio_payload != NULL) {
+        ret = esp_socketio_packet_encode_to_buffer(packet, packet->socketio_payload, packet->payload_capacity, &encoded_len);
+    }
+
+    if (ret == ESP_ERR_INVALID_SIZE) {
+        // cJSON_PrintPreallocated also fails for other reasons than the size: grow once to the measured size
+        size_t new_capacity = 0;
+        ret = measure_message(packet, &new_capacity);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        if (new_capacity > packet->payload_capacity) {
+            char *new_payload = realloc(packet->socketio_payload, new_capacity);
+            ESP_SOCKETIO_MEM_CHECK(TAG, new_payload, return ESP_ERR_NO_MEM);
+            packet->socketio_payload = new_payload;
+            packet->payload_capacity = new_capacity;
+        }
+        ret = esp_socketio_packet_encode_to_buffer(packet, packet->socketio_payload, packet->payload_capacity, &encoded_len);
+        if (ret == ESP_ERR_INVALID_SIZE) {
+            ESP_LOGE(TAG, "Cannot print JSON.");
+            return ESP_FAIL;
+        }
+    }
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    packet->data_len = encoded_len;
+    return ESP_OK;
+}
+
+// Buffer size that fits the encoded message, with the margin cJSON_PrintPreallocated needs
+esp_err_t measure_message(esp_socketio_packet_handle_t packet, size_t *capacity)
+{
+    // Worst case of esp_socketio_packet_encode_header, which checks it against the whole buffer
+    size_t size = 2 + (INT_DIGITS_MAX + 1) + (strlen(packet->nsp) + 1) + INT_DIGITS_MAX + 1;
+    cJSON *json = esp_socketio_packet_get_json(packet);
+    if (json != NULL) {
+        char *printed = cJSON_PrintUnformatted(json);
+        if (printed == NULL) {
+            ESP_LOGE(TAG, "Cannot print JSON.");
+            return ESP_FAIL;
+        }
+        size += strlen(printed) + 5 + 1;
+        cJSON_free(printed);
+    }
+    *capacity = (size < SOCKETIO_PAYLOAD_MIN_CAPACITY) ? SOCKETIO_PAYLOAD_MIN_CAPACITY : size;
     return ESP_OK;
 }
 
 bool is_eio_packet_type_valid(char type)
 {
-    if (type >= EIO_PACKET_TYPE_OPEN || type <= EIO_PACKET_TYPE_NOOP) {
+    if (type >= EIO_PACKET_TYPE_OPEN && type <= EIO_PACKET_TYPE_NOOP) {
         return true;
     }
     ESP_LOGE(TAG, "Invalid eio type.");
@@ -482,7 +904,7 @@ bool is_sio_packet_type_valid(char eio_type, char sio_type)
 {
     if (is_eio_packet_type_valid(eio_type)) {
         if (eio_type == EIO_PACKET_TYPE_MESSAGE) {
-            if (sio_type >= SIO_PACKET_TYPE_CONNECT || sio_type <= SIO_PACKET_TYPE_BINARY_ACK) {
+            if (sio_type >= SIO_PACKET_TYPE_CONNECT && sio_type <= SIO_PACKET_TYPE_BINARY_ACK) {
                 return true;
             }
             ESP_LOGE(TAG, "Invalid sio type.");
@@ -503,4 +925,254 @@ bool is_json_valid(cJSON *json)
         return false;
     }
     return true;
-}
\ No newline at end of file
+}
+
+const char *parse_uint(const char *pos, const char *end, int *value_ptr)
+{
+    const char *start = pos;
+    int value = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9') {
+        if (value > (INT_MAX - (*pos - '0')) / 10) {
+            return NULL;
+        }
+        value = value * 10 + (*pos - '0');
+        pos++;
+    }
+    if (pos == start) {
+        return NULL;
+    }
+    *value_ptr = value;
+    return pos;
+}
+
+char *write_uint(char *pos, unsigned int value)
+{
+    char digits[INT_DIGITS_MAX];
+    int num_digits = 0;
+    do {
+        digits[num_digits++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (num_digits > 0) {
+        *pos++ = digits[--num_digits];
+    }
+    return pos;
+}
+
+esp_socketio_binary_data_t *append_binary_entry(esp_socketio_packet_handle_t packet)
+{
+    if (packet->binary_data_num == packet->binary_data_capacity) {
+        // The announced count sizes the table in one go for received packets
+        if (packet->binary_data_capacity > INT_MAX / 2) {
+            return NULL;
+        }
+        int new_capacity = packet->binary_data_capacity * 2;
+        if (new_capacity < packet->binary_data_count) {
+            new_capacity = packet->binary_data_count;
+        }
+        if (new_capacity < SOCKETIO_BINARY_MIN_CAPACITY) {
+            new_capacity = SOCKETIO_BINARY_MIN_CAPACITY;
+        }
+        if (esp_socketio_packet_reserve_binary_data(packet, new_capacity) != ESP_OK) {
+            return NULL;
+        }
+    }
+    return &packet->binary_data[packet->binary_data_num];
+}
+
+void release_nothing(const unsigned char *data, size_t data_size, void *arg)
+{
+}
+
+void clear_lazy_json(esp_socketio_packet_handle_t packet)
+{
+    for (int i = 0; i < packet->args_num; i++) {
+        // Arguments in the arena are released with it
+        if (!packet->args[i].in_arena) {
+            cJSON_Delete(packet->args[i].json);
+        }
+    }
+    packet->args_num = 0;
+    packet->json_pending = false;
+    packet->event_name = NULL;
+}
+
+bool has_event_name(esp_socketio_packet_handle_t packet)
+{
+    return packet->sio_type == SIO_PACKET_TYPE_EVENT || packet->sio_type == SIO_PACKET_TYPE_BINARY_EVENT;
+}
+
+#if CONFIG_ESP_SOCKETIO_LAZY_JSON
+esp_err_t parse_lazy_json(esp_socketio_packet_handle_t packet, const char *json, size_t len)
+{
+    if (reserve_json_buffer(packet, len + 1) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(packet->json_buffer, json, len);
+    packet->json_buffer[len] = '\0';
+    packet->json_len = len;
+
+    esp_err_t ret = scan_json_array(packet);
+    if (ret != ESP_OK || !has_event_name(packet)) {
+        packet->json_pending = (ret == ESP_OK);
+        return ret;
+    }
+
+    // The event name is the only part decoded eagerly; it is stored after the payload
+    if (packet->args_num == 0 || packet->json_buffer[packet->args[0].offset] != '"') {
+        return ESP_FAIL;
+    }
+    size_t name_len = packet->args[0].len - 2;
+    if (reserve_json_buffer(packet, len + 1 + name_len + 1) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    char *name = packet->json_buffer + len + 1;
+    const char *raw_name = packet->json_buffer + packet->args[0].offset + 1;
+    if (memchr(raw_name, '\\', name_len) == NULL) {
+        memcpy(name, raw_name, name_len);
+        name[name_len] = '\0';
+    } else {
+        // Escaped names are rare, let cJSON unescape them. The unescaped name is never longer.
+        cJSON *name_json = cJSON_ParseWithLength(raw_name - 1, name_len + 2);
+        if (!cJSON_IsString(name_json)) {
+            cJSON_Delete(name_json);
+            return ESP_FAIL;
+        }
+        strcpy(name, name_json->valuestring);
+        cJSON_Delete(name_json);
+    }
+    packet->event_name = name;
+    packet->json_pending = true;
+    return ESP_OK;
+}
+
+esp_err_t scan_json_array(esp_socketio_packet_handle_t packet)
+{
+    // Delimit the top-level array elements without decoding them. Nesting and strings are tracked
+    // so that commas inside them are skipped; everything else is validated when an element is decoded.
+    const char *start = packet->json_buffer;
+    const char *pos = start;
+    const char *end = start + packet->json_len;
+
+    while (pos < end && isspace((unsigned char)*pos)) {
+        pos++;
+    }
+    if (pos == end || *pos++ != '[') {
+        return ESP_FAIL;
+    }
+    while (pos < end && isspace((unsigned char)*pos)) {
+        pos++;
+    }
+
+    bool closed = (pos < end && *pos == ']');
+    if (closed) {
+        pos++;
+    }
+    while (!closed) {
+        const char *arg_start = pos;
+        int depth = 0;
+        while (pos < end) {
+            if (*pos == '"') {
+                for (pos++; pos < end && *pos != '"'; pos++) {
+                    if (*pos == '\\') {
+                        pos++;
+                    }
+                }
+                if (pos >= end) {
+                    return ESP_FAIL;
+                }
+            } else if (*pos == '[' || *pos == '{') {
+                depth++;
+            } else if (*pos == ']' || *pos == '}') {
+                if (depth == 0) {
+                    break;
+                }
+                depth--;
+            } else if (*pos == ',' && depth == 0) {
+                break;
+            }
+            pos++;
+        }
+        if (pos >= end || (*pos == '}' && depth == 0)) {
+            return ESP_FAIL;
+        }
+
+        const char *arg_end = pos;
+        while (arg_end > arg_start && isspace((unsigned char)arg_end[-1])) {
+            arg_end--;
+        }
+        if (arg_end == arg_start) {
+            return ESP_FAIL;
+        }
+
+        if (packet->args_num == packet->args_capacity) {
+            int new_capacity = (packet->args_capacity == 0) ? SOCKETIO_ARGS_MIN_CAPACITY : packet->args_capacity * 2;
+            esp_socketio_json_span_t *args = realloc(packet->args, new_capacity * sizeof(esp_socketio_json_span_t));
+            ESP_SOCKETIO_MEM_CHECK(TAG, args, return ESP_ERR_NO_MEM);
+            packet->args = args;
+            packet->args_capacity = new_capacity;
+        }
+        packet->args[packet->args_num++] = (esp_socketio_json_span_t) {
+            .offset = arg_start - start,
+            .len = arg_end - arg_start,
+            .json = NULL,
+        };
+
+        closed = (*pos == ']');
+        for (pos++; pos < end && isspace((unsigned char)*pos); pos++) {
+        }
+    }
+
+    while (pos < end && isspace((unsigned char)*pos)) {
+        pos++;
+    }
+    return (pos == end) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t reserve_json_buffer(esp_socketio_packet_handle_t packet, size_t size)
+{
+    if (size <= packet->json_buffer_capacity) {
+        return ESP_OK;
+    }
+    size_t new_capacity = (packet->json_buffer_capacity == 0) ? SOCKETIO_PAYLOAD_MIN_CAPACITY : packet->json_buffer_capacity * 2;
+    if (new_capacity < size) {
+        new_capacity = size;
+    }
+    char *json_buffer = realloc(packet->json_buffer, new_capacity);
+    ESP_SOCKETIO_MEM_CHECK(TAG, json_buffer, return ESP_ERR_NO_MEM);
+    packet->json_buffer = json_buffer;
+    packet->json_buffer_capacity = new_capacity;
+    return ESP_OK;
+}
+#endif
+
+cJSON *parse_json(esp_socketio_packet_handle_t packet, const char *json, size_t len, bool *in_arena)
+{
+    *in_arena = false;
+#if CONFIG_ESP_SOCKETIO_JSON_ARENA
+    if (packet->json_arena == NULL) {
+        packet->json_arena = esp_socketio_json_arena_create(CONFIG_ESP_SOCKETIO_JSON_ARENA_CHUNK_SIZE);
+        if (packet->json_arena == NULL) {
+            return NULL;
+        }
+    }
+    *in_arena = esp_socketio_json_arena_begin(packet->json_arena);
+    cJSON *item = cJSON_ParseWithLength(json, len);
+    esp_socketio_json_arena_end();
+    return item;
+#else
+    return cJSON_ParseWithLength(json, len);
+#endif
+}
+
+void delete_json_payload(esp_socketio_packet_handle_t packet)
+{
+    if (packet->json_in_arena) {
+        // Released by the next reset of the arena
+        packet->json_in_arena = false;
+        packet->json_payload = NULL;
+        return;
+    }
+    cJSON_Delete(packet->json_payload);
+    packet->json_payload = NULL;
+}
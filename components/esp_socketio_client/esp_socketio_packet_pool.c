@@ -0,0 +1,125 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include "esp_socketio_packet_pool.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_socketio_internal.h"
+
+static const char *TAG = "socketio_packet_pool";
+
+struct esp_socketio_packet_pool {
+    esp_socketio_packet_handle_t    *idle;
+    size_t                          size;
+    size_t                          idle_num;
+    size_t                          outstanding;        // Packets taken and not released yet
+    bool                            closed;             // Destroyed while packets were outstanding
+    SemaphoreHandle_t               lock;
+};
+
+static void recycle_packet(esp_socketio_packet_handle_t packet, void *arg);
+static void free_pool(esp_socketio_packet_pool_handle_t pool);
+
+esp_socketio_packet_pool_handle_t esp_socketio_packet_pool_create(size_t size)
+{
+    esp_socketio_packet_pool_handle_t pool = calloc(1, sizeof(struct esp_socketio_packet_pool));
+    ESP_SOCKETIO_MEM_CHECK(TAG, pool, return NULL);
+
+    pool->size = size;
+    if (size > 0) {
+        pool->idle = calloc(size, sizeof(esp_socketio_packet_handle_t));
+        ESP_SOCKETIO_MEM_CHECK(TAG, pool->idle, goto error);
+    }
+    pool->lock = xSemaphoreCreateMutex();
+    ESP_SOCKETIO_MEM_CHECK(TAG, pool->lock, goto error);
+    return pool;
+
+error:
+    free_pool(pool);
+    return NULL;
+}
+
+esp_socketio_packet_handle_t esp_socketio_packet_pool_get(esp_socketio_packet_pool_handle_t pool)
+{
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    esp_socketio_packet_handle_t packet = NULL;
+    xSemaphoreTake(pool->lock, portMAX_DELAY);
+    if (pool->idle_num > 0) {
+        packet = pool->idle[--pool->idle_num];
+    }
+    pool->outstanding++;
+    xSemaphoreGive(pool->lock);
+
+    if (packet == NULL) {
+        packet = esp_socketio_packet_init();
+        if (packet == NULL) {
+            xSemaphoreTake(pool->lock, portMAX_DELAY);
+            pool->outstanding--;
+            xSemaphoreGive(pool->lock);
+            return NULL;
+        }
+        esp_socketio_packet_set_recycle_cb(packet, recycle_packet, pool);
+    }
+    return packet;
+}
+
+void esp_socketio_packet_pool_destroy(esp_socketio_packet_pool_handle_t pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(pool->lock, portMAX_DELAY);
+    for (size_t i = 0; i < pool->idle_num; i++) {
+        esp_socketio_packet_destroy(pool->idle[i]);
+    }
+    pool->idle_num = 0;
+    pool->closed = true;
+    size_t outstanding = pool->outstanding;
+    xSemaphoreGive(pool->lock);
+
+    if (outstanding == 0) {
+        free_pool(pool);
+    } else {
+        ESP_LOGD(TAG, "%d packets still referenced", (int)outstanding);
+    }
+}
+
+void recycle_packet(esp_socketio_packet_handle_t packet, void *arg)
+{
+    esp_socketio_packet_pool_handle_t pool = (esp_socketio_packet_pool_handle_t)arg;
+    // Freed outside of the lock, so the releasing task pays for it rather than the next one taking a packet
+    esp_socketio_packet_reset(packet);
+
+    xSemaphoreTake(pool->lock, portMAX_DELAY);
+    pool->outstanding--;
+    bool keep = !pool->closed && pool->idle_num < pool->size;
+    if (keep) {
+        pool->idle[pool->idle_num++] = packet;
+    }
+    bool last = pool->closed && pool->outstanding == 0;
+    xSemaphoreGive(pool->lock);
+
+    if (!keep) {
+        esp_socketio_packet_destroy(packet);
+    }
+    if (last) {
+        free_pool(pool);
+    }
+}
+
+void free_pool(esp_socketio_packet_pool_handle_t pool)
+{
+    if (pool->lock) {
+        vSemaphoreDelete(pool->lock);
+    }
+    free(pool->idle);
+    free(pool);
+}
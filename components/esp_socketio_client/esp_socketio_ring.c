@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "esp_socketio_ring.h"
+#include "esp_socketio_internal.h"
+
+static const char *TAG = "socketio_ring";
+
+struct esp_socketio_ring {
+    uint8_t             *items;
+    size_t              item_size;
+    uint32_t            capacity;
+    uint32_t            mask;                       // Number of slots minus one, a power of 2 so the counters can wrap
+    _Atomic uint32_t    head;                       // Items popped, only written by the consumer
+    _Atomic uint32_t    tail;                       // Items pushed, only written by the producer
+};
+
+esp_socketio_ring_handle_t esp_socketio_ring_create(size_t capacity, size_t item_size)
+{
+    if (capacity == 0 || capacity > UINT32_MAX / 2 || item_size == 0) {
+        return NULL;
+    }
+    esp_socketio_ring_handle_t ring = calloc(1, sizeof(struct esp_socketio_ring));
+    ESP_SOCKETIO_MEM_CHECK(TAG, ring, return NULL);
+
+    uint32_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    ring->items = calloc(slots, item_size);
+    ESP_SOCKETIO_MEM_CHECK(TAG, ring->items, {
+        free(ring);
+        return NULL;
+    });
+    ring->item_size = item_size;
+    ring->capacity = capacity;
+    ring->mask = slots - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return ring;
+}
+
+bool esp_socketio_ring_push(esp_socketio_ring_handle_t ring, const void *item)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // Acquire: the consumer is done reading the slot before `head` moves past it
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head >= ring->capacity) {
+        return false;
+    }
+    memcpy(ring->items + (tail & ring->mask) * ring->item_size, item, ring->item_size);
+    // Release: the item is visible before the consumer sees the new tail
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool esp_socketio_ring_pop(esp_socketio_ring_handle_t ring, void *item)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    memcpy(item, ring->items + (head & ring->mask) * ring->item_size, ring->item_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+void esp_socketio_ring_destroy(esp_socketio_ring_handle_t ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+    free(ring->items);
+    free(ring);
+}
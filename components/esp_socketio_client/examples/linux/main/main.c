@@ -13,7 +13,6 @@
 #include "esp_socketio_client.h"
 
 static const char *TAG = "socketio";
-static esp_socketio_packet_handle_t tx_packet_handle = NULL;
 
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -92,6 +91,7 @@ static void socketio_event_handler(void *handler_args, esp_event_base_t base, in
     {
     case SOCKETIO_EVENT_OPENED:
         ESP_LOGI(TAG, "Received Socket.IO OPEN packet.");
+        // After a reconnection the client is already connecting the joined namespaces, this call sends nothing then
         esp_socketio_client_connect_nsp(data->client, NULL, NULL);
         break;
 
@@ -99,14 +99,16 @@ static void socketio_event_handler(void *handler_args, esp_event_base_t base, in
         char * nsp = esp_socketio_packet_get_nsp(packet);
         if (strcmp(nsp, "/") == 0) {
             ESP_LOGI(TAG, "Socket.IO connected to default namespace \"/\"");
+            // Returns ESP_OK without sending while "/chat" is being connected again after a reconnection
             // Connecting to "/chat" namespace
             cJSON *json = cJSON_CreateObject();
             cJSON_AddStringToObject(json, "token", "!@#$%^&*()-=_+");
             esp_socketio_client_connect_nsp(data->client, "/chat", json);
         } else {
             ESP_LOGI(TAG, "Socket.IO connected to namespace: \"%s\"", nsp);
+            esp_socketio_packet_handle_t tx_packet_handle = esp_socketio_client_acquire_packet(data->client);
             if (esp_socketio_packet_set_header(tx_packet_handle, EIO_PACKET_TYPE_MESSAGE, SIO_PACKET_TYPE_BINARY_EVENT, nsp, 0) == ESP_OK) {
-                cJSON *array = cJSON_CreateArray();
+                cJSON *array = esp_socketio_packet_create_json_array(tx_packet_handle);
                 cJSON_AddItemToArray(array, cJSON_CreateString("hello"));
                 cJSON_AddItemToArray(array, cJSON_CreateNumber(1));
                 cJSON_AddItemToArray(array, cJSON_CreateBool(1));
@@ -119,14 +121,13 @@ static void socketio_event_handler(void *handler_args, esp_event_base_t base, in
                 cJSON_AddBoolToObject(bin_object_2, "_placeholder", true);
                 cJSON_AddNumberToObject(bin_object_2, "num", 1);
                 cJSON_AddItemToArray(array, bin_object_2);
-                esp_socketio_packet_set_json(tx_packet_handle, array);
                 ESP_LOGI(TAG, "address of bin_object_1: %p, size: %lu", (void *)bin_object_1, sizeof(cJSON *));
                 ESP_LOGI(TAG, "address of bin_object_2: %p, size: %lu", (void *)bin_object_2, sizeof(cJSON *));
                 esp_socketio_packet_add_binary_data(tx_packet_handle, (unsigned char *)&bin_object_1, sizeof(cJSON *), true);
                 esp_socketio_packet_add_binary_data(tx_packet_handle, (unsigned char *)&bin_object_2, sizeof(cJSON *), true);
                 esp_socketio_client_send_data(data->client, tx_packet_handle);
-                esp_socketio_packet_reset(tx_packet_handle);
             }
+            esp_socketio_packet_release(tx_packet_handle);
         }
         break;
 
@@ -155,7 +156,6 @@ static void socketio_app_start(void)
     ESP_LOGI(TAG, "Connecting to %s...", socketio_cfg.websocket_config.uri);
 
     esp_socketio_client_handle_t client = esp_socketio_client_init(&socketio_cfg);
-    tx_packet_handle = esp_socketio_client_get_tx_packet(client);
 
     esp_socketio_register_events(client, SOCKETIO_EVENT_ANY, socketio_event_handler, (void *)client);
 
@@ -38,9 +38,69 @@ if (isSecure) {
 // Create a Socket.IO server
 const io = new Server(server);
 
+// Reassemble the packets sent by esp_socketio_client with chunked_transfer, whose attachments are larger than
+// maxHttpBufferSize: a "sio-chunk" event with the original arguments and the attachment sizes, then one
+// "sio-chunk" binary event per slice, numbered from 1. The original event is then handled as if received whole.
+function restorePlaceholders(data, buffers) {
+  if (Array.isArray(data)) {
+    return data.map((item) => restorePlaceholders(item, buffers));
+  }
+  if (data !== null && typeof data === 'object') {
+    if (data._placeholder === true && typeof data.num === 'number') {
+      return buffers[data.num];
+    }
+    const restored = {};
+    for (const key of Object.keys(data)) {
+      restored[key] = restorePlaceholders(data[key], buffers);
+    }
+    return restored;
+  }
+  return data;
+}
+
+function handleChunks(socket) {
+  const transfers = new Map();
+
+  socket.on('sio-chunk', (meta, ...rest) => {
+    const ack = (typeof rest[rest.length - 1] === 'function') ? rest.pop() : undefined;
+    if (Array.isArray(meta.sizes)) {
+      transfers.set(meta.id, {
+        data: meta.data,
+        buffers: meta.sizes.map((size) => Buffer.alloc(size)),
+        remaining: meta.sizes.reduce((sum, size) => sum + size, 0),
+        seq: 0,
+      });
+      return;
+    }
+
+    const transfer = transfers.get(meta.id);
+    const slice = rest[0];
+    if (transfer === undefined || meta.seq !== transfer.seq + 1 || !Buffer.isBuffer(slice)
+        || transfer.buffers[meta.index] === undefined || meta.offset + slice.length > transfer.buffers[meta.index].length) {
+      console.log('Dropping chunked transfer', meta.id);
+      transfers.delete(meta.id);
+      return;
+    }
+    transfer.seq = meta.seq;
+    slice.copy(transfer.buffers[meta.index], meta.offset);
+    transfer.remaining -= slice.length;
+    if (transfer.remaining > 0) {
+      return;
+    }
+
+    transfers.delete(meta.id);
+    const [event, ...args] = restorePlaceholders(transfer.data, transfer.buffers);
+    if (ack !== undefined) {
+      args.push(ack);
+    }
+    socket.listeners(event).forEach((listener) => listener.apply(socket, args));
+  });
+}
+
 // Default namespace ('/')
 io.on('connection', (socket) => {
   console.log('Client connected to the default namespace:', socket.id);
+  handleChunks(socket);
 
   // Listen for 'message' events from the client
   socket.on('message', (msg) => {
@@ -77,6 +137,7 @@ const chatNamespace = io.of('/chat');
 chatNamespace.on('connection', (socket) => {
   console.log('Client connected to the /chat namespace:', socket.id);
   console.log('handshake data: ', socket.handshake.auth.token);
+  handleChunks(socket);
 
   // Demonstrate handling of various data types.
   socket.on("hello", (arg1, arg2, arg3, arg4, arg5, callback) => {
@@ -34,10 +34,27 @@ typedef enum {
     SOCKETIO_EVENT_ERROR = 0,               /*!< This event occurs when there are any errors during execution */
     SOCKETIO_EVENT_OPENED,                  /*!< Socket.IO server has sent open packet */
     SOCKETIO_EVENT_NS_CONNECTED,            /*!< A Socket.IO namespace has been connected. */
-    SOCKETIO_EVENT_DATA,                    /*!< When receiving data from the server, possibly multiple portions of the packet */
+    SOCKETIO_EVENT_DATA,                    /*!< When receiving data from the server, possibly multiple portions of the packet. The packet can be kept with esp_socketio_packet_retain */
+    SOCKETIO_EVENT_NS_READY,                /*!< All the namespaces listed in esp_socketio_client_config_t have been connected */
     SOCKETIO_EVENT_MAX
 } esp_socketio_event_id_t;
 
+/**
+ * @brief Flags of esp_socketio_client_send_data_with_flags
+ */
+typedef enum {
+    ESP_SOCKETIO_SEND_VOLATILE  = (1 << 0),     /*!< Drop the packet if it cannot be sent or queued right away */
+    ESP_SOCKETIO_SEND_COALESCE  = (1 << 1),     /*!< Replace a queued, unsent packet with the same namespace and event name */
+} esp_socketio_send_flags_t;
+
+/**
+ * @brief What the offline buffer does with a packet that does not fit
+ */
+typedef enum {
+    SOCKETIO_OFFLINE_DROP_NEWEST = 0,       /*!< Reject the new packet, esp_socketio_client_send_data returns ESP_ERR_NO_MEM */
+    SOCKETIO_OFFLINE_DROP_OLDEST,           /*!< Drop the oldest buffered packets to make room */
+} esp_socketio_offline_policy_t;
+
 typedef struct {
     esp_websocket_event_id_t        websocket_event_id;
     esp_websocket_event_data_t      *websocket_event;
@@ -45,12 +62,100 @@ typedef struct {
     esp_socketio_client_handle_t    client;
 } esp_socketio_event_data_t;
 
+/**
+ * @brief Heartbeat statistics, measured from the reception of a PING until its PONG is handed to the transport
+ */
+typedef struct {
+    uint32_t    pong_count;                 /*!< Number of PONGs sent */
+    uint32_t    last_latency_us;            /*!< Latency of the last PONG */
+    uint32_t    max_latency_us;             /*!< Highest latency seen */
+    uint64_t    total_latency_us;           /*!< Sum of all latencies, divide by pong_count for the average */
+} esp_socketio_heartbeat_stats_t;
+
+/**
+ * @brief Namespace connected automatically when the Engine.IO session is opened
+ */
+typedef struct {
+    const char      *nsp;                   /*!< The namespace name, NULL for the default namespace */
+    const cJSON     *auth;                  /*!< Payload of the CONNECT packet, NULL if none. Encoded by esp_socketio_client_init */
+} esp_socketio_namespace_config_t;
+
 typedef struct {
     esp_websocket_client_config_t websocket_config;
+    size_t                        rx_max_message_size;  /*!< Maximum size of a message reassembled from several WebSocket DATA events,
+                                                             0 means CONFIG_ESP_SOCKETIO_RX_MAX_MESSAGE_SIZE */
+    size_t                        ack_table_size;       /*!< Maximum number of pending acknowledgements,
+                                                             0 means CONFIG_ESP_SOCKETIO_ACK_TABLE_SIZE */
+    size_t                        tx_queue_size;        /*!< Number of packets queued for a dedicated sender task,
+                                                             0 to send on the caller's task */
+    int                           tx_task_stack;        /*!< Stack size of the sender task, 0 means CONFIG_ESP_SOCKETIO_TX_TASK_STACK_SIZE */
+    int                           tx_task_prio;         /*!< Priority of the sender task, 0 means CONFIG_ESP_SOCKETIO_TX_TASK_PRIORITY */
+    const esp_socketio_namespace_config_t *namespaces;  /*!< Namespaces whose CONNECT packets are sent back-to-back on OPEN,
+                                                             before SOCKETIO_EVENT_OPENED is posted. SOCKETIO_EVENT_NS_READY
+                                                             is posted once all of them are connected */
+    size_t                        namespace_count;      /*!< Number of entries in namespaces */
+    int                           reconnect_base_ms;    /*!< First reconnection delay, doubled on each failed attempt,
+                                                             0 means CONFIG_ESP_SOCKETIO_RECONNECT_BASE_MS */
+    int                           reconnect_max_ms;     /*!< Maximum reconnection delay, 0 means CONFIG_ESP_SOCKETIO_RECONNECT_MAX_MS */
+    size_t                        offline_buffer_size;  /*!< Bytes of encoded packets kept while a joined namespace is disconnected
+                                                             and sent when it is connected again, 0 to disable */
+    esp_socketio_offline_policy_t offline_policy;       /*!< What to do when the offline buffer or the outbox is full */
+    const char                    *outbox_path;         /*!< Directory of a persistent outbox journal on a mounted filesystem,
+                                                             NULL to disable. See esp_socketio_client_send_data_with_flags */
+    size_t                        outbox_segment_size;  /*!< Size of an outbox segment file,
+                                                             0 means CONFIG_ESP_SOCKETIO_OUTBOX_SEGMENT_SIZE */
+    size_t                        outbox_max_segments;  /*!< Maximum number of outbox segment files,
+                                                             0 means CONFIG_ESP_SOCKETIO_OUTBOX_MAX_SEGMENTS */
+    bool                          chunked_transfer;     /*!< Send attachments larger than the server's maxPayload as sequenced
+                                                             "sio-chunk" events instead of rejecting the packet. The server
+                                                             has to reassemble them, see examples/test_server/server.js */
+    bool                          direct_dispatch;      /*!< Call the handlers registered with esp_socketio_register_events directly
+                                                             from the receiving task instead of posting to an esp_event loop.
+                                                             One handler per event id, plus one for SOCKETIO_EVENT_ANY */
+    size_t                        dispatch_queue_size;  /*!< Number of received packets queued for a dedicated dispatch task running
+                                                             the handlers, 0 to run them on the WebSocket receiving task.
+                                                             The websocket_event of the event data is NULL on that task */
+    int                           dispatch_task_stack;  /*!< Stack size of the dispatch task, 0 means CONFIG_ESP_SOCKETIO_DISPATCH_TASK_STACK_SIZE */
+    int                           dispatch_task_prio;   /*!< Priority of the dispatch task, 0 means CONFIG_ESP_SOCKETIO_DISPATCH_TASK_PRIORITY */
+    bool                          dispatch_task_pinned; /*!< Pin the dispatch task to dispatch_task_core, otherwise it has no affinity */
+    int                           dispatch_task_core;   /*!< Core of the dispatch task when dispatch_task_pinned is set */
 } esp_socketio_client_config_t;
 
 ESP_EVENT_DECLARE_BASE(SOCKETIO_EVENTS);         // declaration of the task events family
 
+/**
+ * @brief Callback receiving the attachments of a binary event as they arrive
+ *
+ * @param packet            The received packet, holding the event header and JSON payload
+ * @param index             Index of the attachment the bytes belong to
+ * @param offset            Offset of `data` within the attachment
+ * @param data              Attachment bytes, only valid during the call
+ * @param len               Number of bytes in `data`
+ * @param total_len         Size of the attachment, or 0 if not known in advance (fragmented WebSocket message)
+ * @param arg               User context
+ * @return ESP_OK to continue, any other value drops the rest of the event
+ */
+typedef esp_err_t (*esp_socketio_binary_sink_cb_t)(esp_socketio_packet_handle_t packet, int index, size_t offset,
+                                                   const unsigned char *data, size_t len, size_t total_len, void *arg);
+
+/**
+ * @brief Handler of one Socket.IO event name, registered with esp_socketio_client_on
+ *
+ * @param client            The client handle
+ * @param packet            The received packet, only valid during the call unless retained with esp_socketio_packet_retain
+ * @param arg               User context
+ */
+typedef void (*esp_socketio_event_handler_t)(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet, void *arg);
+
+/**
+ * @brief Callback receiving the ACK of a packet sent with esp_socketio_client_send_data_with_ack
+ *
+ * @param client            The client handle
+ * @param packet            The ACK packet, only valid during the call unless retained, or NULL if the ack timed out
+ * @param arg               User context
+ */
+typedef void (*esp_socketio_ack_cb_t)(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet, void *arg);
+
 esp_socketio_client_handle_t esp_socketio_client_init(const esp_socketio_client_config_t *config);
 
 /**
@@ -65,22 +170,97 @@ esp_err_t esp_socketio_client_start(esp_socketio_client_handle_t client);
 /**
  * @brief Connect to a Socket.IO namespace
  *
+ * With a TX queue, the CONNECT packet is sent by the TX task ahead of all queued packets.
+ * After a reconnection, the joined namespaces are connected again by the client before SOCKETIO_EVENT_OPENED
+ * is posted. Calling this for a joined namespace whose CONNECT is still pending sends nothing and returns ESP_OK,
+ * so it can be called from every SOCKETIO_EVENT_OPENED handler without connecting the namespace twice.
+ *
  * @param client            The client handle
  * @param nsp               The namespace name
  * @param data              Additional payload to be appended to the CONNECT packet
- * @return esp_err_t
+ * @return
+ *     - ESP_OK if the CONNECT packet is sent, or already pending for the namespace
+ *     - ESP_ERR_INVALID_STATE if the Engine.IO connection is not open
+ *     - ESP_ERR_INVALID_ARG if the namespace is already connected
  */
 esp_err_t esp_socketio_client_connect_nsp(esp_socketio_client_handle_t client, const char *nsp, const cJSON *data);
 
 /**
  * @brief Send a Socket.IO packet
  *
+ * With a TX queue (tx_queue_size > 0), the packet contents are moved to the queue without copy and
+ * `packet` is left empty; the call never blocks on the network.
+ *
+ * Engine.IO closes the connection on a WebSocket message larger than the server's maxPayload, so such packets are
+ * rejected before anything is sent, unless chunked_transfer is set and only attachments are too large.
+ * With a TX queue, the size of the text frame is only known, and checked, when the TX task sends it.
+ *
  * @param client            The client handle
  * @param packet            The handle of the packet to be sent
- * @return esp_err_t
+ * @return
+ *     - ESP_ERR_TIMEOUT if the TX queue is full
+ *     - ESP_ERR_INVALID_SIZE if the packet is larger than maxPayload
  */
 esp_err_t esp_socketio_client_send_data(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet);
 
+/**
+ * @brief Send a Socket.IO packet with delivery flags, e.g. for periodic telemetry
+ *
+ * With ESP_SOCKETIO_SEND_VOLATILE, a packet that cannot be sent because the client is not connected
+ * or cannot be queued because the TX queue is full is dropped: its contents are released and ESP_OK is returned.
+ * With ESP_SOCKETIO_SEND_COALESCE and a TX queue, a queued packet that has not been sent yet and has the
+ * same namespace and event name is replaced in place by `packet`, so the newest value keeps its position
+ * in the queue and takes no extra slot. Queued packets requesting an acknowledgement are never replaced. Without a TX queue, packets are never waiting and this flag has no effect.
+ *
+ * With an offline buffer (offline_buffer_size > 0), a packet for a namespace that was joined but is not connected,
+ * e.g. while reconnecting, is encoded into the buffer and sent when the namespace is connected again, before
+ * SOCKETIO_EVENT_NS_CONNECTED is posted. Volatile packets are never buffered.
+ *
+ * With an outbox (outbox_path set), such events are appended to a journal on the filesystem instead, and so are
+ * all events of joined namespaces while the journal is not empty, to keep them in order. Other packets, e.g. ACKs,
+ * are never journaled. The journal survives restarts. It is drained once the namespaces are connected, each event
+ * with an ack id of its own; events of a namespace that is not connected yet are set aside meanwhile, so the order
+ * is only kept within a namespace. The server must acknowledge every journaled event: segment files are deleted
+ * once all their events are acknowledged, and events not acknowledged within CONFIG_ESP_SOCKETIO_OUTBOX_ACK_TIMEOUT_MS
+ * are sent again, so the server may receive duplicates. Without a TX queue, they are sent again by the dispatch
+ * task, or by the receiving task on its next event.
+ * Buffered and journaled packets are checked against the maxPayload of the connection they are sent on, and are not
+ * chunked: those with a larger frame are dropped.
+ * Packets sent with esp_socketio_client_send_data_with_ack are never journaled: ESP_ERR_INVALID_STATE is returned
+ * instead.
+ *
+ * @param client            The client handle
+ * @param packet            The handle of the packet to be sent, left empty when queued, replaced or dropped
+ * @param flags             Bitwise OR of esp_socketio_send_flags_t
+ * @return
+ *     - ESP_ERR_TIMEOUT if the TX queue is full and the packet is not volatile
+ *     - ESP_ERR_INVALID_SIZE if the packet is larger than maxPayload
+ *     - ESP_ERR_NO_MEM if the offline buffer or the outbox is full and offline_policy is SOCKETIO_OFFLINE_DROP_NEWEST
+ *     - ESP_ERR_INVALID_STATE if the client is not connected, or if the packet requests an acknowledgement
+ *       and would be journaled
+ */
+esp_err_t esp_socketio_client_send_data_with_flags(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet, int flags);
+
+/**
+ * @brief Send a Socket.IO packet requesting an acknowledgement
+ *
+ * The client allocates the ack id, sets it in the packet and calls `cb` when the matching ACK is received,
+ * or with a NULL packet after `timeout_ms`. ACKs matching a pending id are not posted as SOCKETIO_EVENT_DATA.
+ * With an outbox, the packet is only sent while its namespace is connected and the journal is empty:
+ * the journal sends its events with ack ids of its own, so ESP_ERR_INVALID_STATE is returned otherwise.
+ *
+ * @param client            The client handle
+ * @param packet            The handle of the packet to be sent
+ * @param timeout_ms        Timeout in milliseconds, 0 to wait forever
+ * @param cb                The callback
+ * @param arg               User context passed to `cb`
+ * @return
+ *     - ESP_ERR_NO_MEM if too many acks are pending
+ *     - ESP_ERR_INVALID_STATE if the client is not connected, or if the packet would be journaled
+ */
+esp_err_t esp_socketio_client_send_data_with_ack(esp_socketio_client_handle_t client, esp_socketio_packet_handle_t packet,
+                                                 uint32_t timeout_ms, esp_socketio_ack_cb_t cb, void *arg);
+
 /**
  * @brief      Send Engine.IO close packet and close the WebSocket connection in a clean way
  *
@@ -112,8 +292,24 @@ esp_err_t esp_socketio_client_close(esp_socketio_client_handle_t client, TickTyp
  */
 esp_err_t esp_socketio_client_destroy(esp_socketio_client_handle_t client);
 
+/**
+ * @brief      Check out an empty packet from the packet pool of the client, to build and send a packet.
+ *             Give it back with esp_socketio_packet_release once sent; its buffers and attachment table
+ *             are kept by the pool, so emitting the same kind of packets again does not allocate.
+ *             Unlike esp_socketio_client_get_tx_packet, each caller gets its own packet, from any task.
+ *
+ * @param[in]  client  The client
+ *
+ * @return
+ *     - A packet holding one reference
+ *     - NULL if any errors
+ */
+esp_socketio_packet_handle_t esp_socketio_client_acquire_packet(esp_socketio_client_handle_t client);
+
 /**
  * @brief      Get the handle to a packet pre-allocated for transmission.
+ *             The same packet is returned to every caller, so it must only be used by one task;
+ *             other producers should use esp_socketio_client_acquire_packet.
  *
  * @param[in]  client  The client
  *
@@ -131,14 +327,94 @@ esp_socketio_packet_handle_t esp_socketio_client_get_tx_packet(esp_socketio_clie
  */
 int esp_socketio_client_get_max_payload(esp_socketio_client_handle_t client);
 
+/**
+ * @brief Get the heartbeat statistics of the client
+ *
+ * With a TX queue, PONG, CONNECT and CLOSE frames go through a control lane that the TX task drains
+ * before each queued packet and between the attachments of a binary packet, so the PONG latency stays
+ * bounded by a single frame rather than by the queue depth. Without a TX queue they are sent right away,
+ * unless another task is sending a packet with attachments: they then wait in the control lane, PONG
+ * between the attachments and CONNECT until the packet is complete. The lane grows as needed, so
+ * control frames are never dropped for lack of room.
+ *
+ * @param client            The client handle
+ * @param stats             Filled with the statistics
+ * @return esp_err_t
+ */
+esp_err_t esp_socketio_client_get_heartbeat_stats(esp_socketio_client_handle_t client, esp_socketio_heartbeat_stats_t *stats);
+
+/**
+ * @brief Check whether the server restored the previous session of a namespace when it was last connected
+ *
+ * When the WebSocket connection drops, the WebSocket client reconnects after a jittered exponential backoff
+ * (reconnect_base_ms, reconnect_max_ms), the Engine.IO handshake is run again and the namespaces joined
+ * with esp_socketio_client_connect_nsp or listed in the config are connected again, unless the server
+ * disconnected them. If the server enables connection state recovery (Socket.IO 4.6+), the CONNECT packets
+ * carry the session pid and the offset of the last received event, and the server replays the missed events.
+ * Call this from the SOCKETIO_EVENT_NS_CONNECTED handler to skip restoring application state.
+ *
+ * @param client            The client handle
+ * @param nsp               The namespace, NULL for the default namespace
+ * @return true if the session was recovered
+ */
+bool esp_socketio_client_is_recovered(esp_socketio_client_handle_t client, const char *nsp);
+
+/**
+ * @brief Register a handler for one event name in a namespace
+ *
+ * Event names are hashed at registration, so dispatching a received EVENT or BINARY_EVENT is a single
+ * table lookup. Events with a handler are passed to it directly instead of being posted as
+ * SOCKETIO_EVENT_DATA; other events and ACKs are still posted as SOCKETIO_EVENT_DATA.
+ * Registering the same namespace and event again replaces the handler. Handlers can be registered
+ * from any task, also while the client runs; a handler removed from another task than the one running
+ * the handlers may still be completing the current event when this returns.
+ *
+ * @param client            The client handle
+ * @param nsp               The namespace, NULL for the default namespace
+ * @param event_name        The event name
+ * @param handler           The handler, NULL to remove it
+ * @param arg               User context
+ * @return esp_err_t
+ */
+esp_err_t esp_socketio_client_on(esp_socketio_client_handle_t client, const char *nsp, const char *event_name,
+                                 esp_socketio_event_handler_t handler, void *arg);
+
+/**
+ * @brief Stream the attachments of a binary event to a callback instead of buffering them
+ *
+ * When a BINARY_EVENT named `event_name` arrives on `nsp`, its attachments are passed to `sink`
+ * chunk by chunk as they are received and are not stored in the packet, so they are not bounded
+ * by the receive buffer size. The event is dispatched once the last attachment is complete.
+ * Registering the same namespace and event again replaces the sink. Sinks can be registered from
+ * any task, also while the client runs; a sink removed from another task may still be completing
+ * the chunk being delivered when this returns, it gets no further chunk. An event whose sink is removed
+ * or replaced while its attachments are received is dropped, and is not posted as SOCKETIO_EVENT_DATA.
+ *
+ * @param client            The client handle
+ * @param nsp               The namespace, NULL for the default namespace
+ * @param event_name        The event name
+ * @param sink              The callback, NULL to remove the sink
+ * @param arg               User context
+ * @return esp_err_t
+ */
+esp_err_t esp_socketio_client_register_binary_sink(esp_socketio_client_handle_t client, const char *nsp, const char *event_name,
+                                                   esp_socketio_binary_sink_cb_t sink, void *arg);
+
 /**
  * @brief Register the Socket.IO Events
  *
+ * With direct_dispatch, the handler is called from the receiving task with the event data of the caller,
+ * which is only valid during the call, and only one handler can be registered per event id.
+ * Registering is allowed at any time; an event being dispatched meanwhile may not reach the new handler.
+ *
  * @param client            The client handle
- * @param event             The event id
+ * @param event             The event id, SOCKETIO_EVENT_ANY for all events
  * @param event_handler     The callback function
  * @param event_handler_arg User context
- * @return esp_err_t
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the arguments are invalid
+ *     - ESP_ERR_INVALID_STATE if a handler is already registered for the event with direct_dispatch
  */
 esp_err_t esp_socketio_register_events(esp_socketio_client_handle_t client,
                                         esp_socketio_event_id_t event,
@@ -21,8 +21,9 @@ extern "C" {
 typedef struct esp_socketio_ns_list *esp_socketio_ns_list_handle_t;
 
 /**
- * @brief Create a new empty namespace list by allocating memory for the structure and
- *             initializing the head pointer to NULL.
+ * @brief Create a new empty namespace list.
+ *             Namespaces are interned in a hash table, so lookups take constant time and do not allocate.
+ *             The list is locked internally, so it can be updated by one task while others look it up.
  *             This function must be the first function to call.
  *             It returns a esp_socketio_ns_list_handle_t that you must use as input to
  *             other functions in the interface.
@@ -36,23 +37,25 @@ typedef struct esp_socketio_ns_list *esp_socketio_ns_list_handle_t;
 esp_socketio_ns_list_handle_t esp_socketio_ns_list_create();
 
 /**
- * @brief Add a namespace to the namespace list.
+ * @brief Add a namespace to the namespace list, or update its session ID if it is already in the list.
+ *          NULL, "" and "/" all refer to the default namespace.
  *
  * @param ns_list           The namespace list handle returned by esp_socketio_ns_list_create
- * @param nsp               The namespace name
+ * @param nsp               The namespace name, at most ESP_SOCKETIO_NSP_MAX_LEN characters
  * @param sid               Session ID of the namespace
  * @return esp_err_t
  */
-esp_err_t esp_socketio_ns_list_add_ns(esp_socketio_ns_list_handle_t ns_list, char *nsp, char *sid);
+esp_err_t esp_socketio_ns_list_add_ns(esp_socketio_ns_list_handle_t ns_list, const char *nsp, const char *sid);
 
 /**
  * @brief Search the sid of a namespace in the list.
+ *          The string is freed when the namespace is removed or added again.
  *
  * @param ns_list           The namespace list handle returned by esp_socketio_ns_list_create
  * @param nsp               The namespace name
  * @return char *           The sid string
  */
-char *esp_socketio_ns_list_search_sid(esp_socketio_ns_list_handle_t ns_list, char *nsp);
+char *esp_socketio_ns_list_search_sid(esp_socketio_ns_list_handle_t ns_list, const char *nsp);
 
 /**
  * @brief Check if a namespace exist in the namespace list.
@@ -63,6 +66,26 @@ char *esp_socketio_ns_list_search_sid(esp_socketio_ns_list_handle_t ns_list, cha
  */
 bool esp_socketio_ns_list_is_nsp_exist(esp_socketio_ns_list_handle_t ns_list, const char *nsp);
 
+/**
+ * @brief Attach user data to a namespace of the list, e.g. per-namespace state of the client.
+ *
+ * @param ns_list           The namespace list handle returned by esp_socketio_ns_list_create
+ * @param nsp               The namespace name
+ * @param data              The data, not freed by the list
+ * @return
+ *     - ESP_ERR_NOT_FOUND if the namespace is not in the list
+ */
+esp_err_t esp_socketio_ns_list_set_data(esp_socketio_ns_list_handle_t ns_list, const char *nsp, void *data);
+
+/**
+ * @brief Get the user data attached to a namespace of the list.
+ *
+ * @param ns_list           The namespace list handle returned by esp_socketio_ns_list_create
+ * @param nsp               The namespace name
+ * @return void *           The data, NULL if none or if the namespace is not in the list
+ */
+void *esp_socketio_ns_list_get_data(esp_socketio_ns_list_handle_t ns_list, const char *nsp);
+
 /**
  * @brief Get number of namespaces in the namespace list.
  *
@@ -78,7 +101,15 @@ int esp_socketio_ns_list_get_num(esp_socketio_ns_list_handle_t ns_list);
  * @param nsp               The namespace name
  * @return esp_err_t
  */
-esp_err_t esp_socketio_ns_list_delete_ns(esp_socketio_ns_list_handle_t ns_list, char *nsp);
+esp_err_t esp_socketio_ns_list_delete_ns(esp_socketio_ns_list_handle_t ns_list, const char *nsp);
+
+/**
+ * @brief Remove all namespaces from the namespace list, keeping the list usable.
+ *
+ * @param ns_list           The namespace list handle returned by esp_socketio_ns_list_create
+ * @return void
+ */
+void esp_socketio_ns_list_clear(esp_socketio_ns_list_handle_t ns_list);
 
 /**
  * @brief Destroy the namespace list.
@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <cJSON.h>
+#include "sdkconfig.h"
 #include "esp_err.h"
 
 #ifdef __cplusplus
@@ -19,9 +20,38 @@ extern "C" {
 #endif
 
 #define ESP_SOCKETIO_CLIENT_SID_LEN     (20)
+#define ESP_SOCKETIO_NSP_MAX_LEN        (CONFIG_ESP_SOCKETIO_NSP_MAX_LEN)
 
 typedef struct esp_socketio_packet *esp_socketio_packet_handle_t;
 
+/**
+ * @brief Callback releasing a binary buffer attached by reference with esp_socketio_packet_add_binary_data_ref
+ *
+ * @param data              Pointer to the binary data
+ * @param data_size         Binary data size
+ * @param arg               User context given to esp_socketio_packet_add_binary_data_ref
+ */
+typedef void (*esp_socketio_binary_release_cb_t)(const unsigned char *data, size_t data_size, void *arg);
+
+/**
+ * @brief Callback producing the bytes of an attachment added with esp_socketio_packet_add_binary_reader
+ *
+ * @param buf               Buffer to fill
+ * @param offset            Offset within the attachment of the first requested byte
+ * @param len               Number of bytes requested
+ * @param arg               User context given to esp_socketio_packet_add_binary_reader
+ * @return Number of bytes written to `buf` (1 to `len`), or a negative value on error
+ */
+typedef int (*esp_socketio_binary_reader_cb_t)(unsigned char *buf, size_t offset, size_t len, void *arg);
+
+/**
+ * @brief Callback taking back a packet whose last reference was released, instead of destroying it
+ *
+ * @param packet            The packet, with one reference again
+ * @param arg               User context given to esp_socketio_packet_set_recycle_cb
+ */
+typedef void (*esp_socketio_packet_recycle_cb_t)(esp_socketio_packet_handle_t packet, void *arg);
+
 typedef enum {
     EIO_PACKET_TYPE_UNKNOWN = 0,
     EIO_PACKET_TYPE_OPEN    = '0',
@@ -44,6 +74,21 @@ typedef enum {
     SIO_PACKET_TYPE_BINARY_ACK      = '6',
 } esp_socketio_packet_type_t;
 
+/**
+ * @brief Header of a Socket.IO packet, as located by esp_socketio_packet_parse_header.
+ *          The namespace and payload spans point into the parsed buffer and are not NUL-terminated.
+ */
+typedef struct {
+    esp_engineio_packet_type_t  eio_type;
+    esp_socketio_packet_type_t  sio_type;
+    int                         binary_count;   /*!< Number of binary attachments, 0 if none */
+    const char                  *nsp;           /*!< Start of the namespace, NULL means default namespace "/" */
+    int                         nsp_len;        /*!< Length of the namespace */
+    int                         event_id;       /*!< Socket.IO event ID. Negative value means no ID present. */
+    const char                  *payload;       /*!< Start of the JSON payload, NULL if no payload present */
+    int                         payload_len;    /*!< Length of the JSON payload */
+} esp_socketio_packet_header_t;
+
 /**
  * @brief Initialize memory space for a Socket.IO packet
  *             This function must be the first function to call.
@@ -63,7 +108,8 @@ esp_socketio_packet_handle_t esp_socketio_packet_init();
  * @param[in] packet        The packet handle
  * @param[in] eio_type      The Engine.IO packet type
  * @param[in] sio_type      The Socket.IO packet type
- * @param[in] nsp           The namespace string. NULL means use default namespace "/".
+ * @param[in] nsp           The namespace string. NULL or "/" means use default namespace "/".
+ *                          At most ESP_SOCKETIO_NSP_MAX_LEN characters.
  * @param[in] event_id      The Socket.IO event ID. Negative value means no ID present.
  *
  * @return
@@ -91,6 +137,44 @@ esp_err_t esp_socketio_packet_reset(esp_socketio_packet_handle_t packet);
  */
 void esp_socketio_packet_destroy(esp_socketio_packet_handle_t packet);
 
+/**
+ * @brief Take one more reference to the packet. A received packet retained by a handler stays valid after
+ *          the handler returns, without copy, until the matching esp_socketio_packet_release.
+ *          Can be called from any task holding a reference.
+ *
+ * @param[in] packet            The packet handle
+ *
+ * @return    The packet handle
+ */
+esp_socketio_packet_handle_t esp_socketio_packet_retain(esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Drop one reference to the packet. The last one destroys the packet, or hands it to its recycle callback.
+ *          A packet returned by esp_socketio_packet_init holds one reference.
+ *
+ * @param[in] packet            The packet handle
+ */
+void esp_socketio_packet_release(esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Whether references other than the caller's are held on the packet
+ *
+ * @param[in] packet            The packet handle
+ *
+ * @return    true if the packet was retained
+ */
+bool esp_socketio_packet_is_shared(esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Set the callback called instead of esp_socketio_packet_destroy when the last reference is released,
+ *          typically to put the packet back in a pool. Kept across esp_socketio_packet_reset and esp_socketio_packet_swap.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] cb                The callback, NULL to destroy the packet
+ * @param[in] arg               User context passed to the callback
+ */
+void esp_socketio_packet_set_recycle_cb(esp_socketio_packet_handle_t packet, esp_socketio_packet_recycle_cb_t cb, void *arg);
+
 /**
  * @brief Return the Engine.IO type of the Socket.IO packet.
  *          The packet must be parsed or constructed before this call. Otherwise EIO_PACKET_TYPE_UNKNOWN is returned.
@@ -127,6 +211,10 @@ char *esp_socketio_packet_get_nsp(esp_socketio_packet_handle_t packet);
 /**
  * @brief Return the JSON payload of the Socket.IO packet.
  *          The packet must be parsed or constructed before this call. Otherwise NULL is returned.
+ *          With CONFIG_ESP_SOCKETIO_LAZY_JSON, the tree of a received EVENT or ACK is built on the first call,
+ *          and NULL is also returned if the payload turns out to be invalid JSON.
+ *          With CONFIG_ESP_SOCKETIO_JSON_ARENA, the tree of a received packet lives in the arena of the packet:
+ *          its items must not be deleted, detached or replaced.
  *
  * @param[in] packet            The packet handle
  *
@@ -135,6 +223,40 @@ char *esp_socketio_packet_get_nsp(esp_socketio_packet_handle_t packet);
  */
 cJSON *esp_socketio_packet_get_json(esp_socketio_packet_handle_t packet);
 
+/**
+ * @brief Return the event name of an EVENT or BINARY_EVENT packet, i.e. the first element of its JSON array.
+ *          With CONFIG_ESP_SOCKETIO_LAZY_JSON, this does not build the JSON tree of a received packet.
+ *
+ * @param[in] packet            The packet handle
+ *
+ * @return    The event name, or NULL if the packet is not an event. The pointer shall not be freed.
+ *
+ */
+const char *esp_socketio_packet_get_event_name(esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Return the number of arguments of the Socket.IO packet, not counting the event name.
+ *
+ * @param[in] packet            The packet handle
+ *
+ * @return
+ *      Number of arguments, or -1 if any errors
+ *
+ */
+int esp_socketio_packet_get_arg_count(esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Return one argument of the Socket.IO packet, not counting the event name.
+ *          With CONFIG_ESP_SOCKETIO_LAZY_JSON, only this argument is decoded, on the first call.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] index             Index of the argument
+ *
+ * @return    Pointer to the cJSON, or NULL if there is no such argument or it is invalid. The pointer shall not be freed.
+ *
+ */
+cJSON *esp_socketio_packet_get_arg(esp_socketio_packet_handle_t packet, int index);
+
 /**
  * @brief Return all payload of the Socket.IO packet as raw data string.
  *          The packet must be parsed or constructed before this call. Otherwise NULL is returned.
@@ -158,9 +280,34 @@ char *esp_socketio_packet_get_raw_data(esp_socketio_packet_handle_t packet, int
  */
 int esp_socketio_packet_get_event_id(esp_socketio_packet_handle_t packet);
 
+/**
+ * @brief Set the event ID in the Socket.IO packet, keeping the rest of the packet.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] event_id          The Socket.IO event ID. Negative value means no ID present.
+ *
+ * @return
+ *      esp_err_t
+ *
+ */
+esp_err_t esp_socketio_packet_set_event_id(esp_socketio_packet_handle_t packet, int event_id);
+
+/**
+ * @brief Exchange the contents of two packets, including their buffers, in constant time.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] other             The other packet handle
+ *
+ * @return
+ *      esp_err_t
+ *
+ */
+esp_err_t esp_socketio_packet_swap(esp_socketio_packet_handle_t packet, esp_socketio_packet_handle_t other);
+
 /**
  * @brief Set the JSON object in the Socket.IO packet.
  *          A copy of the JSON object will be made and copied to the packet.
+ *          Use esp_socketio_packet_take_json or esp_socketio_packet_create_json_array to avoid the copy.
  *
  * @param[in] packet            The packet handle
  * @param[in] json              The JSON object
@@ -171,6 +318,31 @@ int esp_socketio_packet_get_event_id(esp_socketio_packet_handle_t packet);
  */
 esp_err_t esp_socketio_packet_set_json(esp_socketio_packet_handle_t packet, const cJSON *json);
 
+/**
+ * @brief Set the JSON object in the Socket.IO packet, taking ownership of it.
+ *          No copy is made. The JSON object is freed by the packet on reset or destroy
+ *          and shall not be freed nor used by the caller afterwards.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] json              The JSON object
+ *
+ * @return
+ *      esp_err_t
+ *
+ */
+esp_err_t esp_socketio_packet_take_json(esp_socketio_packet_handle_t packet, cJSON *json);
+
+/**
+ * @brief Create an empty JSON array as the payload of the Socket.IO packet, to be filled in place
+ *          with the event name and arguments. The array is owned by the packet.
+ *
+ * @param[in] packet            The packet handle
+ *
+ * @return    Pointer to the cJSON array. The pointer shall not be freed. NULL if any errors.
+ *
+ */
+cJSON *esp_socketio_packet_create_json_array(esp_socketio_packet_handle_t packet);
+
 /**
  * @brief Add one set of binary data in the Socket.IO packet.
  *          One set corresponds to one _placeholder.
@@ -188,7 +360,88 @@ esp_err_t esp_socketio_packet_set_json(esp_socketio_packet_handle_t packet, cons
 int esp_socketio_packet_add_binary_data(esp_socketio_packet_handle_t packet, const unsigned char *data, size_t data_size, bool increment);
 
 /**
- * @brief Destroy the binary data list and free all binary buffer in the Socket.IO packet.
+ * @brief Add one set of binary data in the Socket.IO packet by reference, without copying it.
+ *          The buffer must stay valid until `release_cb` is called, which happens once the data
+ *          has been handed to the transport by esp_socketio_client_send_data, or when the packet
+ *          is reset or destroyed without being sent.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] data              Pointer to binary data
+ * @param[in] data_size         Binary data size
+ * @param[in] release_cb        Callback releasing the buffer. Can be NULL.
+ * @param[in] release_arg       User context passed to `release_cb`
+ *
+ * @return
+ *      Index of the binary data, or -1 if any errors
+ *
+ */
+int esp_socketio_packet_add_binary_data_ref(esp_socketio_packet_handle_t packet, const unsigned char *data, size_t data_size,
+        esp_socketio_binary_release_cb_t release_cb, void *release_arg);
+
+/**
+ * @brief Add one set of binary data in the Socket.IO packet whose bytes are produced by a reader callback,
+ *          e.g. from flash or a file. esp_socketio_client_send_data calls `reader` in chunks of
+ *          CONFIG_ESP_SOCKETIO_TX_CHUNK_SIZE bytes and streams them as a fragmented WebSocket message,
+ *          so the attachment never has to be held in memory. If `reader` fails, the packet cannot be
+ *          completed: the connection is closed, and opened again, and sending the packet fails.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] data_size         Attachment size
+ * @param[in] reader            Callback producing the attachment bytes
+ * @param[in] reader_arg        User context passed to `reader`
+ *
+ * @return
+ *      Index of the binary data, or -1 if any errors
+ *
+ */
+int esp_socketio_packet_add_binary_reader(esp_socketio_packet_handle_t packet, size_t data_size,
+        esp_socketio_binary_reader_cb_t reader, void *reader_arg);
+
+/**
+ * @brief Get the reader of a binary data set added with esp_socketio_packet_add_binary_reader
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] index             Index of the binary data
+ * @param[out] reader_ptr       Reader callback
+ * @param[out] reader_arg_ptr   User context of the reader
+ * @param[out] data_size_ptr    Attachment size
+ *
+ * @return
+ *      ESP_ERR_NOT_FOUND if the binary data set does not exist or is not produced by a reader
+ *
+ */
+esp_err_t esp_socketio_packet_get_binary_reader(esp_socketio_packet_handle_t packet, int index,
+        esp_socketio_binary_reader_cb_t *reader_ptr, void **reader_arg_ptr, size_t *data_size_ptr);
+
+/**
+ * @brief Release a binary data set added with esp_socketio_packet_add_binary_data_ref, calling its release callback.
+ *          Copied binary data and already released sets are left untouched.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] index             Index of the binary data
+ *
+ * @return
+ *      void
+ *
+ */
+void esp_socketio_packet_release_binary_data_ref(esp_socketio_packet_handle_t packet, int index);
+
+/**
+ * @brief Reserve room for a number of binary data sets in the Socket.IO packet,
+ *          so that adding them does not grow the attachment table.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] num               Number of binary data sets
+ *
+ * @return
+ *      esp_err_t
+ *
+ */
+esp_err_t esp_socketio_packet_reserve_binary_data(esp_socketio_packet_handle_t packet, int num);
+
+/**
+ * @brief Remove all binary data from the Socket.IO packet and release the buffers added by reference.
+ *          The attachment table and the buffers holding copies are kept for reuse.
  *
  * @param[in] packet            The packet handle
  *
@@ -221,7 +474,23 @@ int esp_socketio_packet_count_binary_data(esp_socketio_packet_handle_t packet);
 int esp_socketio_packet_get_last_binary_index(esp_socketio_packet_handle_t packet);
 
 /**
- * @brief Get one set of binary data in the Socket.IO packet.
+ * @brief Get the binary data set at the given index in the Socket.IO packet.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] index             Index of the binary data, i.e. the `num` of its _placeholder
+ * @param[in] data_ptr          Return the pointer to the binary data
+ * @param[in] data_size_ptr     Return the pointer to the binary data size
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_NOT_FOUND if no binary data exists at the index
+ *      - ESP_ERR_INVALID_ARG
+ *
+ */
+esp_err_t esp_socketio_packet_get_binary_data(esp_socketio_packet_handle_t packet, int index, unsigned char **data_ptr, size_t *data_size_ptr);
+
+/**
+ * @brief Get one set of binary data in the Socket.IO packet and advance to the next one.
  *
  * @param[in] packet            The packet handle
  * @param[in] data_ptr          Return the pointer to the binary data
@@ -250,6 +519,20 @@ esp_err_t esp_socketio_packet_get_current_binary_data(esp_socketio_packet_handle
  */
 esp_err_t esp_socketio_parse_open_packet(const char *buf, int len, char *sid_ptr, int *ping_interval_ptr, int *ping_timeout_ptr, int *max_payload_ptr);
 
+/**
+ * @brief Parse the header of a Socket.IO packet in a single pass, without allocating memory.
+ *          The returned spans point into `buf`, which must stay valid while they are used.
+ *
+ * @param[in] buf               data buffer to parse
+ * @param[in] len               length of the data buffer
+ * @param[out] header           Return the located header fields
+ *
+ * @return
+ *      esp_err_t
+ *
+ */
+esp_err_t esp_socketio_packet_parse_header(const char *buf, int len, esp_socketio_packet_header_t *header);
+
 /**
  * @brief Parse a Socket.IO packet.
  *
@@ -262,13 +545,53 @@ esp_err_t esp_socketio_parse_open_packet(const char *buf, int len, char *sid_ptr
  */
 esp_err_t esp_socketio_packet_parse_message(esp_socketio_packet_handle_t packet, const char *buf, int len);
 
+/**
+ * @brief Encode a Socket.IO packet header into a caller-provided buffer, without allocating memory.
+ *          The payload span of the header is ignored. The output is NUL-terminated.
+ *
+ * @param[in] header            The header to encode
+ * @param[in] buf               Output buffer
+ * @param[in] buf_size          Size of the output buffer
+ * @param[out] out_len          Return the encoded length, excluding the NUL terminator
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_SIZE if the buffer is too small
+ *      - ESP_ERR_INVALID_ARG
+ *
+ */
+esp_err_t esp_socketio_packet_encode_header(const esp_socketio_packet_header_t *header, char *buf, size_t buf_size, size_t *out_len);
+
+/**
+ * @brief Encode a Socket.IO packet (header and JSON payload) into a caller-provided buffer in a single pass,
+ *          without allocating memory. The output is NUL-terminated.
+ *
+ * @param[in] packet            The packet handle
+ * @param[in] buf               Output buffer
+ * @param[in] buf_size          Size of the output buffer
+ * @param[out] out_len          Return the encoded length, excluding the NUL terminator
+ *
+ * @return
+ *      - ESP_OK
+ *      - ESP_ERR_INVALID_SIZE if the buffer is too small
+ *      - ESP_ERR_INVALID_ARG
+ *
+ */
+esp_err_t esp_socketio_packet_encode_to_buffer(esp_socketio_packet_handle_t packet, char *buf, size_t buf_size, size_t *out_len);
+
 /**
  * @brief Encode a Socket.IO packet according to Socket.IO specification.
+ *          The result is written into a buffer owned by the packet, which is kept across
+ *          esp_socketio_packet_reset and only grows when a larger message is encoded.
+ *          Use esp_socketio_packet_get_raw_data to access the result.
  *
  * @param[in] packet            The packet handle
  *
  * @return
- *      esp_err_t
+ *      - ESP_OK
+ *      - ESP_ERR_NO_MEM if the buffer cannot grow
+ *      - ESP_FAIL if the JSON cannot be printed
+ *      - ESP_ERR_INVALID_ARG
  *
  */
 esp_err_t esp_socketio_packet_encode_message(esp_socketio_packet_handle_t packet);
@@ -0,0 +1,88 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _ESP_SOCKETIO_ACK_TABLE_H_
+#define _ESP_SOCKETIO_ACK_TABLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_socketio_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_socketio_ack_table *esp_socketio_ack_table_handle_t;
+
+/**
+ * @brief Create a table of pending acknowledgements.
+ *          Ack ids are allocated by the table and index it directly; timeouts are expired
+ *          by a single periodic timer driving a timer wheel.
+ *
+ * @param client            The client passed to the ack callbacks
+ * @param size              Maximum number of pending acknowledgements, rounded up to a power of 2
+ * @param tick_ms           Resolution of the timeouts in milliseconds
+ *
+ * @return
+ *     - `esp_socketio_ack_table_handle_t`
+ *     - NULL if any errors
+ */
+esp_socketio_ack_table_handle_t esp_socketio_ack_table_create(esp_socketio_client_handle_t client, size_t size, uint32_t tick_ms);
+
+/**
+ * @brief Allocate an ack id and store its callback.
+ *
+ * @param ack_table         The ack table handle
+ * @param timeout_ms        Time after which `cb` is called with a NULL packet, 0 to wait forever
+ * @param cb                Callback called with the ACK packet
+ * @param arg               User context passed to `cb`
+ * @param id_ptr            Allocated ack id
+ * @return
+ *     - ESP_ERR_NO_MEM if all the ids of the table are pending
+ */
+esp_err_t esp_socketio_ack_table_add(esp_socketio_ack_table_handle_t ack_table, uint32_t timeout_ms,
+                                     esp_socketio_ack_cb_t cb, void *arg, int *id_ptr);
+
+/**
+ * @brief Remove a pending ack id without calling its callback, e.g. when the packet could not be sent.
+ *
+ * @param ack_table         The ack table handle
+ * @param id                The ack id
+ * @return
+ *     - ESP_ERR_NOT_FOUND if the id is not pending
+ */
+esp_err_t esp_socketio_ack_table_cancel(esp_socketio_ack_table_handle_t ack_table, int id);
+
+/**
+ * @brief Call and remove the callback of a received ACK packet.
+ *
+ * @param ack_table         The ack table handle
+ * @param packet            The received ACK packet
+ * @return
+ *     - true if the ack id was pending and its callback has been called
+ */
+bool esp_socketio_ack_table_complete(esp_socketio_ack_table_handle_t ack_table, esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Stop the timeout timer for good. Pending acks no longer expire but can still be completed.
+ *
+ * @param ack_table         The ack table handle
+ */
+void esp_socketio_ack_table_stop(esp_socketio_ack_table_handle_t ack_table);
+
+/**
+ * @brief Destroy the table. Pending callbacks are dropped without being called.
+ *
+ * @param ack_table         The ack table handle
+ */
+void esp_socketio_ack_table_destroy(esp_socketio_ack_table_handle_t ack_table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_ESP_SOCKETIO_ACK_TABLE_H_
@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _ESP_SOCKETIO_JSON_ARENA_H_
+#define _ESP_SOCKETIO_JSON_ARENA_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_socketio_json_arena *esp_socketio_json_arena_handle_t;
+
+/**
+ * @brief Create a bump allocator for cJSON nodes and strings. Memory is taken from chunks that are
+ *          only freed by esp_socketio_json_arena_destroy, so resetting the arena costs nothing.
+ *
+ * @param chunk_size        Size of the chunks in bytes; larger allocations get a chunk of their own
+ *
+ * @return
+ *     - `esp_socketio_json_arena_handle_t`
+ *     - NULL if any errors
+ */
+esp_socketio_json_arena_handle_t esp_socketio_json_arena_create(size_t chunk_size);
+
+/**
+ * @brief Install the cJSON hooks routing allocations to the arenas. Must run before any task parses json,
+ *          esp_socketio_client_init calls it. Later calls do nothing.
+ */
+void esp_socketio_json_arena_install_hooks(void);
+
+/**
+ * @brief Allocate the cJSON nodes and strings of the calling task from `arena`, until esp_socketio_json_arena_end.
+ *          Other tasks keep using the heap.
+ *          Frees of the task are ignored meanwhile, so only cJSON calls building a tree may run in between.
+ *
+ * @param arena             The arena handle
+ *
+ * @return
+ *     - true if the tree is built in the arena
+ *     - false if the hooks are not installed yet, the tree is then built on the heap
+ */
+bool esp_socketio_json_arena_begin(esp_socketio_json_arena_handle_t arena);
+
+/**
+ * @brief Allocate the cJSON nodes and strings of the calling task from the heap again
+ */
+void esp_socketio_json_arena_end(void);
+
+/**
+ * @brief Release at once everything allocated from the arena. Its chunks are kept for reuse.
+ *
+ * @param arena             The arena handle
+ */
+void esp_socketio_json_arena_reset(esp_socketio_json_arena_handle_t arena);
+
+/**
+ * @brief Free the arena and its chunks
+ *
+ * @param arena             The arena handle
+ */
+void esp_socketio_json_arena_destroy(esp_socketio_json_arena_handle_t arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_ESP_SOCKETIO_JSON_ARENA_H_
@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _ESP_SOCKETIO_OFFLINE_BUFFER_H_
+#define _ESP_SOCKETIO_OFFLINE_BUFFER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_socketio_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_socketio_offline_buffer *esp_socketio_offline_buffer_handle_t;
+
+/**
+ * @brief Callback telling whether the packets of a namespace can be flushed
+ *
+ * @param nsp               The namespace of the packet
+ * @param arg               User context
+ * @return true if the namespace is connected
+ */
+typedef bool (*esp_socketio_offline_ready_cb_t)(const char *nsp, void *arg);
+
+/**
+ * @brief Callback sending one WebSocket frame of a buffered packet
+ *
+ * @param index             0 for the text frame of the packet, then 1 + the index of each attachment
+ * @param data              Frame bytes
+ * @param len               Frame length
+ * @param arg               User context
+ * @return ESP_OK if the frame was handed to the transport
+ */
+typedef esp_err_t (*esp_socketio_offline_send_cb_t)(int index, const uint8_t *data, size_t len, void *arg);
+
+/**
+ * @brief Create a buffer of packets emitted while disconnected.
+ *          Packets are stored encoded, with their attachments, in a single ring of `size` bytes,
+ *          so flushing them does no encoding and storing them does not allocate.
+ *
+ * @param size              Size of the ring in bytes
+ * @param policy            What to do when a packet does not fit
+ *
+ * @return
+ *     - `esp_socketio_offline_buffer_handle_t`
+ *     - NULL if any errors
+ */
+esp_socketio_offline_buffer_handle_t esp_socketio_offline_buffer_create(size_t size, esp_socketio_offline_policy_t policy);
+
+/**
+ * @brief Encode a packet and store it with its attachments. Attachments produced by a reader are read now.
+ *          The packet itself is left untouched.
+ *
+ * @param buffer            The buffer handle
+ * @param packet            The packet
+ * @return
+ *     - ESP_ERR_NO_MEM if the packet does not fit and the policy is SOCKETIO_OFFLINE_DROP_NEWEST
+ *     - ESP_ERR_INVALID_SIZE if the packet is larger than the whole buffer
+ */
+esp_err_t esp_socketio_offline_buffer_store(esp_socketio_offline_buffer_handle_t buffer, esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Send, in order, the buffered packets of the namespaces that are ready, and free their room.
+ *          Packets of other namespaces stay buffered. The buffer is locked while sending, so concurrent
+ *          calls do not send a packet twice. Packets with a frame larger than `max_frame` are dropped.
+ *
+ * @param buffer            The buffer handle
+ * @param max_frame         Largest frame accepted by the server, 0 for no limit
+ * @param ready_cb          Callback selecting the namespaces to flush
+ * @param send_cb           Callback sending the frames
+ * @param arg               User context passed to the callbacks
+ * @return Number of packets sent
+ */
+int esp_socketio_offline_buffer_flush(esp_socketio_offline_buffer_handle_t buffer, size_t max_frame,
+                                      esp_socketio_offline_ready_cb_t ready_cb, esp_socketio_offline_send_cb_t send_cb, void *arg);
+
+/**
+ * @brief Destroy the buffer. Buffered packets are dropped.
+ *
+ * @param buffer            The buffer handle
+ */
+void esp_socketio_offline_buffer_destroy(esp_socketio_offline_buffer_handle_t buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_ESP_SOCKETIO_OFFLINE_BUFFER_H_
@@ -0,0 +1,111 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _ESP_SOCKETIO_OUTBOX_H_
+#define _ESP_SOCKETIO_OUTBOX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_socketio_client.h"
+#include "esp_socketio_offline_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_socketio_outbox *esp_socketio_outbox_handle_t;
+
+/**
+ * @brief Callback registering the acknowledgement of a journaled packet about to be sent
+ *
+ * @param token             Token to give back to esp_socketio_outbox_ack
+ * @param arg               User context
+ * @return The ack id to encode in the packet, negative if no more acks can be tracked
+ */
+typedef int (*esp_socketio_outbox_track_cb_t)(uint32_t token, void *arg);
+
+/**
+ * @brief Open the journal stored in `path`, a directory on a mounted filesystem.
+ *          Segments left by a previous run are drained first; new packets go to a new segment.
+ *
+ * @param path              Directory of the segment files
+ * @param segment_size      Maximum size of a segment file in bytes
+ * @param max_segments      Maximum number of segment files
+ * @param policy            What to do when the journal is full: drop the new packet or the oldest segment
+ *
+ * @return
+ *     - `esp_socketio_outbox_handle_t`
+ *     - NULL if any errors
+ */
+esp_socketio_outbox_handle_t esp_socketio_outbox_create(const char *path, size_t segment_size, size_t max_segments,
+                                                        esp_socketio_offline_policy_t policy);
+
+/**
+ * @brief Encode an EVENT or BINARY_EVENT packet and append it with its attachments to the journal.
+ *          The ack id of the packet, if any, is not kept: the journal allocates its own when draining,
+ *          so the server must acknowledge every event for its record to be deleted. Packets with an ack id
+ *          of the caller are not to be appended.
+ *
+ * @param outbox            The outbox handle
+ * @param packet            The packet
+ * @return
+ *     - ESP_ERR_NOT_SUPPORTED if the packet is not an event
+ *     - ESP_ERR_NO_MEM if the journal is full and the policy is SOCKETIO_OFFLINE_DROP_NEWEST
+ *     - ESP_ERR_INVALID_SIZE if the packet is larger than CONFIG_ESP_SOCKETIO_OUTBOX_RECORD_MAX_SIZE
+ *     - ESP_FAIL if the filesystem reported an error
+ */
+esp_err_t esp_socketio_outbox_append(esp_socketio_outbox_handle_t outbox, esp_socketio_packet_handle_t packet);
+
+/**
+ * @brief Whether the journal has no packet waiting to be sent or acknowledged
+ *
+ * @param outbox            The outbox handle
+ * @return true if empty
+ */
+bool esp_socketio_outbox_is_empty(esp_socketio_outbox_handle_t outbox);
+
+/**
+ * @brief Send the next journaled packets, in order, until CONFIG_ESP_SOCKETIO_OUTBOX_WINDOW packets are waiting
+ *          for their acknowledgement. Packets of a namespace that is not ready are set aside and sent first by a
+ *          later call, once it is ready; draining stops when CONFIG_ESP_SOCKETIO_OUTBOX_WINDOW packets are set aside.
+ *          Packets with a frame larger than `max_frame` are dropped.
+ *          The journal is not locked while `send_cb` runs. A call made while another task drains returns at once,
+ *          and that task drains again before returning.
+ *
+ * @param outbox            The outbox handle
+ * @param max_frame         Largest frame accepted by the server, 0 for no limit
+ * @param ready_cb          Callback telling whether the namespace of the next packet is connected
+ * @param track_cb          Callback allocating the ack id of each packet
+ * @param send_cb           Callback sending the frames
+ * @param arg               User context passed to the callbacks
+ * @return Number of packets sent
+ */
+int esp_socketio_outbox_drain(esp_socketio_outbox_handle_t outbox, size_t max_frame, esp_socketio_offline_ready_cb_t ready_cb,
+                              esp_socketio_outbox_track_cb_t track_cb, esp_socketio_offline_send_cb_t send_cb, void *arg);
+
+/**
+ * @brief Report the acknowledgement of a drained packet. Segments whose packets are all acknowledged are deleted.
+ *          On timeout, draining starts again from the oldest packet not acknowledged or set aside.
+ *
+ * @param outbox            The outbox handle
+ * @param token             Token given to the track callback
+ * @param acked             true if acknowledged, false if timed out
+ */
+void esp_socketio_outbox_ack(esp_socketio_outbox_handle_t outbox, uint32_t token, bool acked);
+
+/**
+ * @brief Close the journal. Segments are kept on the filesystem.
+ *
+ * @param outbox            The outbox handle
+ */
+void esp_socketio_outbox_destroy(esp_socketio_outbox_handle_t outbox);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_ESP_SOCKETIO_OUTBOX_H_
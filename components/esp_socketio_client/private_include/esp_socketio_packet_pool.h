@@ -0,0 +1,53 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _ESP_SOCKETIO_PACKET_POOL_H_
+#define _ESP_SOCKETIO_PACKET_POOL_H_
+
+#include <stddef.h>
+#include "esp_socketio_packet.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_socketio_packet_pool *esp_socketio_packet_pool_handle_t;
+
+/**
+ * @brief Create a pool of packets. Packets come back to the pool, reset, when their last reference
+ *          is released with esp_socketio_packet_release, from any task.
+ *
+ * @param size              Maximum number of idle packets kept, extra ones are destroyed
+ *
+ * @return
+ *     - `esp_socketio_packet_pool_handle_t`
+ *     - NULL if any errors
+ */
+esp_socketio_packet_pool_handle_t esp_socketio_packet_pool_create(size_t size);
+
+/**
+ * @brief Take an idle packet from the pool, or allocate one if none is idle
+ *
+ * @param pool              The pool handle
+ * @return
+ *     - An empty packet holding one reference
+ *     - NULL if no memory
+ */
+esp_socketio_packet_handle_t esp_socketio_packet_pool_get(esp_socketio_packet_pool_handle_t pool);
+
+/**
+ * @brief Destroy the pool and its idle packets. Packets still referenced are destroyed on their last release,
+ *          and the last of them frees the pool.
+ *
+ * @param pool              The pool handle
+ */
+void esp_socketio_packet_pool_destroy(esp_socketio_packet_pool_handle_t pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_ESP_SOCKETIO_PACKET_POOL_H_
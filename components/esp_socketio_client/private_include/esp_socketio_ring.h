@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2015-2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _ESP_SOCKETIO_RING_H_
+#define _ESP_SOCKETIO_RING_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_socketio_ring *esp_socketio_ring_handle_t;
+
+/**
+ * @brief Create a lock-free ring of fixed-size items, for one producer task and one consumer task.
+ *          Items are copied in and out; neither side ever blocks or takes a lock.
+ *
+ * @param capacity          Maximum number of items in the ring
+ * @param item_size         Size of an item in bytes
+ *
+ * @return
+ *     - `esp_socketio_ring_handle_t`
+ *     - NULL if any errors
+ */
+esp_socketio_ring_handle_t esp_socketio_ring_create(size_t capacity, size_t item_size);
+
+/**
+ * @brief Copy an item at the end of the ring. Only called by the producer.
+ *
+ * @param ring              The ring handle
+ * @param item              The item
+ * @return false if the ring is full
+ */
+bool esp_socketio_ring_push(esp_socketio_ring_handle_t ring, const void *item);
+
+/**
+ * @brief Copy out and remove the item at the start of the ring. Only called by the consumer.
+ *
+ * @param ring              The ring handle
+ * @param item              Where to copy the item
+ * @return false if the ring is empty
+ */
+bool esp_socketio_ring_pop(esp_socketio_ring_handle_t ring, void *item);
+
+/**
+ * @brief Destroy the ring. Items left in it are dropped.
+ *
+ * @param ring              The ring handle
+ */
+void esp_socketio_ring_destroy(esp_socketio_ring_handle_t ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_ESP_SOCKETIO_RING_H_